@@ -0,0 +1,100 @@
+#!/bin/bash
+# Benchmarks for museumsim, run from anywhere:
+#
+#   ./bench.sh layout [museumsim args]
+#       builds museumsim with the cache line padded semlist and with the packed
+#       one (-DSEMLIST_PACKED), runs both with the same arguments and reports
+#       cache/coherence counters from perf stat (wall/cpu time without perf)
+#
+#   ./bench.sh sweep [extra museumsim args]
+#       runs museumsim over every combination of the space separated lists in
+#       B (semaphore backends, default whatever museumsim defaults to), M, K,
+#       GS (group size, default 10), PV, PG, DV and DG (e.g. B="futex spin"
+#       M="100 1000") with tours shortened to zero and prints one CSV row per
+#       run: the parameters followed by museumsim's run totals (events/s, cpu
+#       time, context switches and semaphore calls per event) and syscalls per
+#       event. Semaphore calls count down()/up(), most of which never enter the
+#       kernel, so the syscalls are counted separately by perf stat's
+#       raw_syscalls:sys_enter tracepoint over the whole run, that column is
+#       left empty without perf or access to the tracepoint. Combinations
+#       where K isn't ceil(M/GS) are skipped: with fewer guides some visitors
+#       never get one, with more the spare guides wait forever for visitors
+#       that aren't coming. Runs still going after TIMEOUT seconds are killed
+#       and marked as such.
+#
+# CC and CFLAGS are handed to the compiler, e.g. CFLAGS=-I/path/to/kernel/include,
+# PERF_EVENTS overrides the counters perf stat collects, binaries go to $OUT.
+
+set -e
+cd "$(dirname "$0")"
+
+CC=${CC:-gcc}
+OUT=${OUT:-/tmp/museumsim-bench}
+PERF_EVENTS=${PERF_EVENTS:-cache-references,cache-misses,LLC-load-misses,context-switches}
+mkdir -p "$OUT"
+
+# build <name> [extra compiler flags]
+build() {
+	name=$1; shift
+	$CC -O2 $CFLAGS "$@" -o "$OUT/$name" museumsim.c -pthread -lm
+}
+
+# measure <binary> <args...>, counters go to stderr
+measure() {
+	bin=$1; shift
+	if command -v perf >/dev/null 2>&1; then
+		perf stat -e "$PERF_EVENTS" "$bin" "$@" >/dev/null
+	else
+		TIMEFORMAT="%R s wall, %U s user, %S s sys"
+		time "$bin" "$@" >/dev/null
+	fi
+}
+
+layout() {
+	build padded
+	build packed -DSEMLIST_PACKED
+	[ $# -gt 0 ] || set -- -m 2000 -k 200 -dv 0 -dg 0 -tt 0 -lt 0
+	for variant in packed padded; do
+		echo "== $variant semlist: $*"
+		measure "$OUT/$variant" "$@"
+	done
+}
+
+sweep() {
+	build museumsim
+	echo "backend,m,k,gs,pv,pg,dv,dg,status,events,wall_s,events_per_s,user_s,sys_s,ctx_switches,ctx_switches_per_event,sem_calls_per_event,syscalls_per_event"
+	syscalls=
+	if command -v perf >/dev/null 2>&1; then syscalls="perf stat -x, -e raw_syscalls:sys_enter -o $OUT/syscalls"; fi
+	for b in ${B:-default}; do
+	if [ "$b" = default ]; then backend=; else backend="-b $b"; fi
+	for m in ${M:-100 500 2000}; do
+	for k in ${K:-10 50 200}; do
+	for gs in ${GS:-10}; do
+		[ "$k" -eq $(((m + gs - 1) / gs)) ] || continue
+		for pv in ${PV:-100 50}; do
+		for pg in ${PG:-100}; do
+		for dv in ${DV:-0}; do
+		for dg in ${DG:-0}; do
+			rm -f "$OUT/syscalls"
+			run=$(timeout "${TIMEOUT:-60}" $syscalls "$OUT/museumsim" $backend -m "$m" -k "$k" -gs "$gs" -pv "$pv" -pg "$pg" -dv "$dv" -dg "$dg" \
+				-tt 0 -lt 0 "$@" | sed -n 's/^run //p')
+			if [ -n "$run" ]; then
+				events=$(echo "$run" | sed 's/^events=\([0-9]*\).*/\1/')
+				per_event=$(awk -F, -v n="$events" '$3 == "raw_syscalls:sys_enter" && $1 ~ /^[0-9]+$/ { printf "%.3f", $1 / n }' \
+					"$OUT/syscalls" 2>/dev/null || true)
+				echo "$b,$m,$k,$gs,$pv,$pg,$dv,$dg,ok,$(echo "$run" | sed 's/[a-z_]*=//g; s/ /,/g'),$per_event"
+			else
+				echo "$b,$m,$k,$gs,$pv,$pg,$dv,$dg,timeout,,,,,,,,,"
+			fi
+		done; done; done; done
+	done; done; done
+	done
+}
+
+cmd=$1
+[ $# -gt 0 ] && shift
+case "$cmd" in
+	layout) layout "$@" ;;
+	sweep)  sweep "$@" ;;
+	*) sed -n '2,/^$/p' "$0" | sed 's/^# \{0,1\}//'; exit 1 ;;
+esac
@@ -1,26 +1,108 @@
 // Derek Nadeau CS1550 Project 2 Spring 2020 // DRN16@pitt.edu
 
+// build: gcc -o museumsim museumsim.c -pthread -lm
+//        gcc -o museumtop museumtop.c, to watch a run started with -tm <name>
+// add -I<cs1550 kernel>/include to get the cs1550 syscall backend, the others work on any Linux
+
+#define _GNU_SOURCE // sched_getaffinity() and pthread_setaffinity_np() for -cp
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <math.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
 
 #include "unistd.h"
 #include "sem.h"
+#include "telemetry.h"
 
+// a semaphore for whichever backend -b picked, every backend keeps its state in the same slot
+struct msem {
+
+	union {
+		struct cs1550_sem 	cs;			// cs1550, the custom kernel's down/up syscalls
+		struct {
+			int 			value;
+			int 			waiters;
+		} 					futex;		// futex, counter in user space, sleep/wake through the kernel
+		sem_t 				posix;		// posix, process-shared sem_t
+		int 				spin;		// spin, counter in user space, never sleeps
+	};
+
+} typedef msem;
+
+struct sem_backend {
+
+	const char * 	name;
+	void 			(* init)(msem * sem, int value);
+	void 			(* down)(msem * sem);
+	void 			(* up)(msem * sem);
+
+} typedef sem_backend;
+
+extern sem_backend backends[];
+sem_backend * backend = &backends[0]; // cs1550 if it was compiled in, futex otherwise
+
+void visitorArrives(int n);
+void tourguideArrives(int n);
 int visitor(int n);
 int guide(int n);
-int real_time();
+long long real_time();
 bool next_arrives_immediatly(int prob);
-void spawner(int (* func)(int), int n, int delay, int prob, int seed);
-void down(struct cs1550_sem * sem) { syscall(__NR_cs1550_down, sem); }
-void up  (struct cs1550_sem * sem) { syscall(__NR_cs1550_up,   sem); }
+struct arrivals;
+struct taskq;
+void spawner(void (* arrive)(int), int (* func)(int), int n, struct arrivals * a, struct taskq * q);
+void worker(int (* func)(int), int w, int n);
+void start_arrivals(struct arrivals * a);
+double next_arrival(struct arrivals * a);
+void sleep_until(double t);
+__thread long long sem_calls = 0; // down()/up() calls made by this process (thread with -co), added to the run total on exit
+void down(msem * sem) { sem_calls++; backend->down(sem); }
+void up  (msem * sem) { sem_calls++; backend->up(sem);   }
+void select_backend(const char * name);
+void initialize_arena();
+void arena_prefault();
+void * arena_alloc(size_t size);
 void initialize_sems();
+int admit_waiting();
+void let_in(int admitted);
+void visitorTours(int n);
+bool try_open(int n, int * admitted);
+bool try_leave(int n, int * claimed_visitors);
+void guides_wake();
+void visitors_gone();
+void run_coroutines(struct arrivals * va, struct arrivals * ga);
+void co_let_in(int admitted);
+void initialize_log();
+void initialize_sched(struct arrivals * va, struct arrivals * ga);
+void sched_wait(int type);
+bool sched_allow(int type);
+void sched_commit(int type);
+void sched_finish();
+void log_event(int actor, int type, int n);
+void * log_writer(void * arg);
+void stats_init();
+void stats_report();
+void * checker(void * arg);
+void check_report();
+void telemetry_init();
+void telemetry_tick();
+void telemetry_finish();
 
 //default values
 int visitors 			= 50; 	// m
@@ -31,40 +113,171 @@ int guides 				= 5;	// k
 int guides_burst_prob 	= 0;	// pg
 int guides_delay 		= 3;	// dg
 int guides_prob_seed 	= 20;	// sg
+int visitors_model		= 'b';	// av, b(urst), p(oisson) or o(n/off)
+int guides_model		= 'b';	// ag
+double visitors_rate	= 10;	// rv, arrivals per second for p and o
+double guides_rate		= 1;	// rg
+double visitors_period	= 1;	// ov, mean length in seconds of each on and off period for o
+double guides_period	= 1;	// og
+char * visitors_trace	= NULL;	// tv, file of arrival times, overrides av
+char * guides_trace		= NULL;	// tg
+double tour_time		= 2;	// tt, seconds each visitor spends touring
+int text_log			= 1;	// lt, 0 turns off the narrative on stdout
+char * binary_log		= NULL;	// lb, file to write raw event records to
+int ns_deltas			= 0;	// ns, 1 appends nanoseconds since the previous event to each line
+char * stats_csv		= NULL;	// c, file to write per-actor timings to
+int workers				= 64;	// w, worker processes per spawner
+int co_threads			= 0;	// co, run every actor as a coroutine on this many threads instead of a process
+int co_pin_threads		= 0;	// cp, 1 pins each coroutine thread to its own CPU
+int check				= 1;	// x, 0 turns off the invariant checker
+int group_size			= 10;	// gs, visitors each guide takes in
+int max_guides			= 2;	// gm, guides allowed in the museum at once
+int huge_pages			= 0;	// hp, 1 backs the shared arena with huge pages
+char * telemetry_name	= NULL;	// tm, shared memory segment to publish live counters to, e.g. /museumsim
+char * sched_record		= NULL;	// ir, file to record the order of critical sections to
+char * sched_replay		= NULL;	// ip, recorded file whose order is enforced
+
+// Each semaphore starts its own cache line with the counter it protects right
+// behind it, so processes hammering one counter don't keep invalidating the
+// line holding another. Build with -DSEMLIST_PACKED for the original back to
+// back layout (bench.sh layout compares the two).
+#define CACHE_LINE 64
+#ifdef SEMLIST_PACKED
+#define LINE_ALIGNED
+#else
+#define LINE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+#endif
 
 struct semlist {
 
-	struct cs1550_sem 	visitor_count_sem;
+	msem				visitor_count_sem LINE_ALIGNED;
 	int 				visitor_count; 			// # of waiting visitors not yet in museum
+	int 				visitors_coming;		// # of visitors that haven't arrived yet
 
-	struct cs1550_sem  	guide_count_sem;
+	msem				guide_count_sem LINE_ALIGNED;
 	int 				guide_count; 			// # of waiting guides not yet in museum
 
-	struct cs1550_sem  	visitors_in_museum_sem; 
+	msem				visitors_in_museum_sem LINE_ALIGNED; 
 	int 				visitors_in_museum;		// # visitors currently in museum
 
-	struct cs1550_sem  	guides_in_museum_sem; 	
+	msem				guides_in_museum_sem LINE_ALIGNED; 	
 	int 				guides_in_museum;		// # guides currently in museum
 
-	struct cs1550_sem	claim_leaving_visitor_sem;
+	msem				claim_leaving_visitor_sem LINE_ALIGNED;
 	int 				claim_leaving_visitor;	// used to keep track of leaving visitors unclaimed by a tour guide
 
-	struct cs1550_sem 	spots_to_claim_sem;
+	msem				spots_to_claim_sem LINE_ALIGNED;
 	int 				spots_to_claim;			// used to keep track of how many arriving visitors can currently enter the museum 
 
+	msem				admit_sem LINE_ALIGNED;	// admitted visitors wait here until they are let in
+
+	msem				guide_wake_sem LINE_ALIGNED;
+	int 				guide_epoch;			// # of turns that have ended, see guide_park()
+	int 				guides_parked;			// # of guides asleep, their ids are the first entries of parked_guides
+	int *				parked_guides;
+	msem *				guide_park_sems;		// one per guide, guides that can't open or leave yet wait on theirs
+
 } typedef semlist;
 
+// arrivals handed from a spawner to its pool of worker processes
+struct taskq {
+
+	msem 				arrivals_sem;	// counts arrivals posted but not yet picked up
+	int 				next;			// next visitor/guide # to hand out
+
+	int 				total;			// # of arrivals, lowered if a trace runs out early
+
+} typedef taskq;
+
+// how a spawner times its arrivals
+enum { BURST = 'b', POISSON = 'p', ONOFF = 'o', TRACE = 't' };
+
+struct arrivals {
+
+	int 			model;
+	int 			prob, delay, seed;	// BURST, the original pv/dv/sv model
+	double 			rate;				// POISSON/ONOFF, arrivals per second while on
+	double 			period;				// ONOFF, mean seconds per on or off period
+	char * 			trace;				// TRACE, file name
+
+	double 			t;					// time of the previous arrival, seconds since start
+	double 			switch_at;			// ONOFF, when the current period ends
+	bool 			on;
+	unsigned short 	xsubi[3];			// erand48 state
+	const char * 	cur;				// TRACE, parse position in the mapped file
+	const char * 	end;
+
+} typedef arrivals;
+
 semlist * sems;
-struct timeval * start_time;
+taskq * tasks;
 
-int main(int argc, char * argv[]) {
+// the visitor or guide this process is currently acting as
+int self_actor = -1;
+int self_id    = -1;
+struct timespec start_time;
 
-	// create shared memory space
-	initialize_sems();
+/////////////
+//   LOG   //
+/////////////
+
+// Actors never print directly. Each event is appended to one of LOG_RINGS
+// shared rings and a single writer thread in the parent drains them in
+// batches, so terminal/disk I/O no longer happens inside critical sections.
+
+#define LOG_RINGS 	16		// # of rings, each actor process writes to one of them
+#define RING_SLOTS 	4096	// events per ring, must be a power of 2
+#define LOG_FLUSH 	65536	// bytes of narrative buffered before the writer flushes
+
+enum { VISITOR, GUIDE };
+enum { ARRIVES, TOURS, OPENS, LEAVES, CLAIMS }; // CLAIMS is only recorded in schedules, never logged
+
+struct event {
+
+	long long 			time;	// real_time() when the event happened, ns since start
+	unsigned int 		seq;	// global order, taken inside the critical section
+	int 				id;		// visitor/guide number
+	unsigned char 		actor;	// VISITOR or GUIDE
+	unsigned char 		type;	// ARRIVES, TOURS, OPENS or LEAVES
+
+} typedef event;
+
+struct log_slot {
+
+	unsigned int 		turn;	// position + 1 once the event is published
+	event 				ev;
+
+} typedef log_slot;
+
+struct log_ring {
+
+	unsigned int 		head __attribute__((aligned(64)));	// next position handed to a producer
+	unsigned int 		tail __attribute__((aligned(64)));	// next position the writer will read
+	log_slot 			slots[RING_SLOTS];
+
+} typedef log_ring;
+
+struct evlog {
+
+	unsigned int 		seq;	// next global sequence number
+	int 				done;	// set by main once every actor has exited
+	long long 			sem_calls; // down()/up() calls of every process that has exited
+	log_ring 			rings[LOG_RINGS];
+
+} typedef evlog;
+
+evlog * elog;
+__thread int log_ring_index = 0; // ring used by this process (thread with -co)
+
+void stats_event(event * e);
+void telemetry_event(event * e);
+void check_push(event * e);
+void check_close();
+
+int main(int argc, char * argv[]) {
 
 	// initalize time vars
-	start_time = malloc(sizeof(struct timeval));
-	gettimeofday(start_time, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
 
 	// parse all input arguments in any order
 	int i;
@@ -95,16 +308,114 @@ int main(int argc, char * argv[]) {
 				if (argv[i][2] == 'v')  { visitors_prob_seed = atoi(argv[i+1]); } 
 				else 					{ guides_prob_seed   = atoi(argv[i+1]); }
 
+			} else if (argv[i][1] == 'a') {
+
+				if (argv[i][2] == 'v')  { visitors_model = argv[i+1][0]; } 
+				else 					{ guides_model   = argv[i+1][0]; }
+
+			} else if (argv[i][1] == 'r') {
+
+				if (argv[i][2] == 'v')  { visitors_rate = atof(argv[i+1]); } 
+				else 					{ guides_rate   = atof(argv[i+1]); }
+
+			} else if (argv[i][1] == 'o') {
+
+				if (argv[i][2] == 'v')  { visitors_period = atof(argv[i+1]); } 
+				else 					{ guides_period   = atof(argv[i+1]); }
+
+			} else if (argv[i][1] == 't') {
+
+				if (argv[i][2] == 'v')  	 { visitors_trace = argv[i+1]; } 
+				else if (argv[i][2] == 't') { tour_time      = atof(argv[i+1]); }
+				else if (argv[i][2] == 'm') { telemetry_name = argv[i+1]; }
+				else 						 { guides_trace   = argv[i+1]; }
+
+			} else if (argv[i][1] == 'i') {
+
+				if (argv[i][2] == 'r')  { sched_record = argv[i+1]; } 
+				else 					{ sched_replay = argv[i+1]; }
+
+			} else if (argv[i][1] == 'b') {
+
+				select_backend(argv[i+1]);
+
+			} else if (argv[i][1] == 'g') {
+
+				if (argv[i][2] == 's')  { group_size = atoi(argv[i+1]); } 
+				else 					{ max_guides = atoi(argv[i+1]); }
+
+			} else if (argv[i][1] == 'h') {
+
+				huge_pages = atoi(argv[i+1]);
+
+			} else if (argv[i][1] == 'x') {
+
+				check = atoi(argv[i+1]);
+
+			} else if (argv[i][1] == 'w') {
+
+				workers = atoi(argv[i+1]);
+
+			} else if (argv[i][1] == 'c') {
+
+				if (argv[i][2] == 'o')  	 { co_threads 	  = atoi(argv[i+1]); } 
+				else if (argv[i][2] == 'p') { co_pin_threads = atoi(argv[i+1]); }
+				else 						 { stats_csv  	  = argv[i+1]; }
+
+			} else if (argv[i][1] == 'n') {
+
+				ns_deltas = atoi(argv[i+1]);
+
+			} else if (argv[i][1] == 'l') {
+
+				if (argv[i][2] == 'b')  { binary_log = argv[i+1]; } 
+				else 					{ text_log   = atoi(argv[i+1]); }
+
 			}
 
 		}
 
 	}
 
-	printf("The museum is now empty.\n");
-	if (fork() == 0)      { spawner(visitor, visitors, visitors_delay, visitors_burst_prob, guides_prob_seed); } 
-	else if (fork() == 0) { spawner(guide,   guides,   guides_delay,   guides_burst_prob,   guides_prob_seed); }
-	else 				  { wait(NULL); wait(NULL); }
+	arrivals va = { visitors_trace ? TRACE : visitors_model, visitors_burst_prob, visitors_delay, visitors_prob_seed,
+					visitors_rate, visitors_period, visitors_trace };
+	arrivals ga = { guides_trace   ? TRACE : guides_model,   guides_burst_prob,   guides_delay,   guides_prob_seed,
+					guides_rate,   guides_period,   guides_trace };
+
+	// reject bad combinations before anything creates files or shared memory
+	if (co_threads > 0 && (sched_record != NULL || sched_replay != NULL)) {
+		fprintf(stderr, "museumsim: -ir/-ip need actor processes, they can't be used with -co\n");
+		exit(1);
+	}
+
+	// create shared memory space
+	initialize_arena();
+	initialize_log();
+	initialize_sems();
+	initialize_sched(&va, &ga);
+	taskq * vq = arena_alloc(sizeof(taskq));
+	taskq * gq = arena_alloc(sizeof(taskq));
+
+	printf("The museum is now empty.\n"); fflush(stdout);
+	if (co_threads == 0) {
+		if (fork() == 0)      { spawner(visitorArrives,   visitor, visitors, &va, vq); } 
+		else if (fork() == 0) { spawner(tourguideArrives, guide,   guides,   &ga, gq); }
+	}
+
+	// writer and checker threads are only started after forking so children never inherit them
+	pthread_t writer, checking;
+	pthread_create(&writer, NULL, log_writer, NULL);
+	if (check) { pthread_create(&checking, NULL, checker, NULL); }
+
+	if (co_threads > 0) { run_coroutines(&va, &ga); } 
+	else 				{ wait(NULL); wait(NULL); }
+
+	__atomic_store_n(&elog->done, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	if (check) { pthread_join(checking, NULL); }
+	stats_report();
+	check_report();
+	sched_finish();
 
 	return 0;
 
@@ -113,119 +424,223 @@ int main(int argc, char * argv[]) {
 
 void initialize_sems() {
 	
-	sems = (semlist*)mmap(NULL, sizeof(semlist), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, 0, 0);
+	sems = (semlist*)arena_alloc(sizeof(semlist));
 
-	sems->visitor_count_sem.value 			= 1;
+	backend->init(&(sems->visitor_count_sem), 1);
 	sems->visitor_count 					= 0;
+	sems->visitors_coming 					= visitors;
 
-	sems->guide_count_sem.value 			= 1;
+	backend->init(&(sems->guide_count_sem), 1);
 	sems->guide_count 						= 0;
 
-	sems->guides_in_museum_sem.value		= 1;
+	backend->init(&(sems->guides_in_museum_sem), 1);
 	sems->guides_in_museum 					= 0;
 
-	sems->visitors_in_museum_sem.value 		= 1;
+	backend->init(&(sems->visitors_in_museum_sem), 1);
 	sems->visitors_in_museum 				= 0;
 
-	sems->claim_leaving_visitor_sem.value 	= 1;
+	backend->init(&(sems->claim_leaving_visitor_sem), 1);
 	sems->claim_leaving_visitor 			= 0;
 
-	sems->spots_to_claim_sem.value 			= 1;
+	backend->init(&(sems->spots_to_claim_sem), 1);
 	sems->spots_to_claim 					= 0;
 
+	backend->init(&(sems->admit_sem), 0);
+
+	backend->init(&(sems->guide_wake_sem), 1);
+	sems->guide_epoch 						= 0;
+	sems->guides_parked 					= 0;
+	sems->parked_guides 					= arena_alloc(guides * sizeof(int));
+	sems->guide_park_sems 					= arena_alloc(guides * sizeof(msem));
+
+	for (int i = 0; i < guides; i++) { backend->init(&(sems->guide_park_sems[i]), 0); }
+
 }
 
-void spawner(int (* func)(int), int n, int delay, int prob, int seed) {
+void spawner(void (* arrive)(int), int (* func)(int), int n, arrivals * a, taskq * q) {
 
-	srand(seed);
+	// fork a fixed pool up front, arrivals are then posted to it instead of forking per actor
+	tasks = q;
+	backend->init(&(tasks->arrivals_sem), 0);
+	tasks->next = 0;
+	tasks->total = n;
+
+	int pool = (workers < n) ? workers : n;
 	int i;
+	for (i = 0; i < pool; i++) {
+		if (fork() == 0) { worker(func, i, n); }
+	}
+
+	log_ring_index = (func == guide) * (LOG_RINGS / 2);
+
+	start_arrivals(a);
 	for (i = 0; i < n; i++) {
 
-		// if not first visitor, check for burst delay and simulate accordingly
-		if (!next_arrives_immediatly(prob) && i != 0) {	sleep(delay); }
-		// create new visitor and guide processes
-		if (fork() == 0) { (*func)(i); }
-		// no need to break, visitor/guide process will exit() on its own
+		if (a->model == BURST) {
+			// if not first visitor, check for burst delay and simulate accordingly
+			if (!next_arrives_immediatly(a->prob) && i != 0) {	sleep(a->delay); }
+		} else {
+			double t = next_arrival(a);
+			if (t < 0) { break; } // trace ran out
+			sleep_until(t);
+		}
+
+		// arrive here so the visitor/guide is counted as waiting even while every worker is busy,
+		// then hand the rest of its life to whichever worker is free
+		self_actor = (func == guide);
+		self_id    = i;
+		(*arrive)(i);
+		up(&(tasks->arrivals_sem));
+
+	}
+
+	// a trace that ran out early leaves guides waiting on visitors that will never come
+	if (func == visitor && i < n) { visitors_gone(); }
+
+	// one extra post per worker so each one wakes up, sees the queue is exhausted and exits
+	__atomic_store_n(&(tasks->total), i, __ATOMIC_RELEASE);
+	for (i = 0; i < pool; i++) { up(&(tasks->arrivals_sem)); }
+
+	// reap every worker so main knows the log is complete once we exit
+	while (wait(NULL) > 0);
+	__atomic_fetch_add(&(elog->sem_calls), sem_calls, __ATOMIC_RELAXED);
+	exit(0);
+
+}
+
+void worker(int (* func)(int), int w, int n) {
+
+	// each worker owns a ring, visitors use the lower half and guides the upper half
+	log_ring_index = (func == guide) * (LOG_RINGS / 2) + w % (LOG_RINGS / 2);
+
+	while (true) {
+
+		down(&(tasks->arrivals_sem));
+		int id = __atomic_fetch_add(&(tasks->next), 1, __ATOMIC_RELAXED);
+		if (id >= __atomic_load_n(&(tasks->total), __ATOMIC_ACQUIRE)) { break; }
+		self_actor = (func == guide);
+		self_id    = id;
+		(*func)(id);
 
 	}
 
-	wait(NULL);
+	__atomic_fetch_add(&(elog->sem_calls), sem_calls, __ATOMIC_RELAXED);
 	exit(0);
 
 }
 
+///////////////
+// ADMISSION //
+///////////////
+
+// Caller holds guides_in_museum_sem, visitor_count_sem, spots_to_claim_sem and
+// visitors_in_museum_sem. Moves every waiting visitor that has both a spot and
+// room under the guides inside into the museum in one step and returns how
+// many, the caller then lets them in with let_in() after releasing everything.
+int admit_waiting() {
+
+	int batch = sems->visitor_count;
+	if (batch > sems->spots_to_claim) { batch = sems->spots_to_claim; }
+	int room = sems->guides_in_museum * group_size - sems->visitors_in_museum;
+	if (batch > room) { batch = room; }
+	if (batch <= 0) { return 0; }
+
+	sems->visitor_count 		-= batch;
+	sems->spots_to_claim 		-= batch;
+	sems->visitors_in_museum 	+= batch;
+	return batch;
+
+}
+
+// the admitted visitors don't have to be the ones we counted, whoever is waiting takes the places
+void let_in(int admitted) {
+
+	if (co_threads > 0) { co_let_in(admitted); return; }
+
+	int i;
+	for (i = 0; i < admitted; i++) { up(&(sems->admit_sem)); }
+
+}
+
 /////////////
 // VISITOR //
 /////////////
 
 void visitorArrives(int n) {
 
+	sched_wait(ARRIVES);
+	down(&(sems->guides_in_museum_sem));
 	down(&(sems->visitor_count_sem));
+	down(&(sems->spots_to_claim_sem));
+	down(&(sems->visitors_in_museum_sem));
 
 	sems->visitor_count++;
-	printf("Visitor %d arrives at time %d.\n", n, real_time()); fflush(stdout);
+	sems->visitors_coming--;
+	log_event(VISITOR, ARRIVES, n);
+	int admitted = admit_waiting(); // walks straight in if a guide has room
+	sched_commit(ARRIVES);
 
+	up(&(sems->guides_in_museum_sem));
+	up(&(sems->spots_to_claim_sem));
 	up(&(sems->visitor_count_sem));
+	up(&(sems->visitors_in_museum_sem));
+
+	let_in(admitted);
 
 }
 
 void tourMuseum(int n) {
 
-	bool can_enter = false;
-	while (!can_enter) {
+	// whoever admitted us already took our spot, just wait to be let in
+	sched_wait(TOURS);
+	down(&(sems->admit_sem));
+	visitorTours(n);
 
-		down(&(sems->guides_in_museum_sem));
-		down(&(sems->visitor_count_sem));
-		down(&(sems->spots_to_claim_sem));
-		down(&(sems->visitors_in_museum_sem));
-
-		can_enter = (sems->visitors_in_museum < (sems->guides_in_museum * 10)) && sems->spots_to_claim > 0;
-		
-		if (can_enter) {
-
-			sems->visitor_count--;
-			
-			sems->spots_to_claim--;
-			
-			sems->visitors_in_museum++;
-
-			printf("Visitor %d tours the museum at time %d.\n", n, real_time()); fflush(stdout);
-
-		}
+	if (tour_time > 0) {
+		struct timespec tour = { (time_t)tour_time, (long)((tour_time - (time_t)tour_time) * 1e9) };
+		nanosleep(&tour, NULL);
+	}
 
-		up(&(sems->guides_in_museum_sem));
-		up(&(sems->spots_to_claim_sem));
-		up(&(sems->visitor_count_sem));
-		up(&(sems->visitors_in_museum_sem));
-		
+}
 
-	}
+void visitorTours(int n) {
 
-	sleep(2);
+	log_event(VISITOR, TOURS, n);
+	sched_commit(TOURS);
 
 }
 
 void visitorLeaves(int n) {
 
+	sched_wait(LEAVES);
 	down(&(sems->claim_leaving_visitor_sem));
+	down(&(sems->guides_in_museum_sem));
+	down(&(sems->visitor_count_sem));
+	down(&(sems->spots_to_claim_sem));
 	down(&(sems->visitors_in_museum_sem));
 
 	sems->claim_leaving_visitor++;
 	sems->visitors_in_museum--;
 
-	printf("Visitor %d leaves the museum at time %d.\n", n, real_time()); fflush(stdout);
+	log_event(VISITOR, LEAVES, n);
+	int admitted = admit_waiting(); // our place may be the one a waiting visitor needed
+	sched_commit(LEAVES);
 	
 	up(&(sems->claim_leaving_visitor_sem));
+	up(&(sems->guides_in_museum_sem));
+	up(&(sems->spots_to_claim_sem));
+	up(&(sems->visitor_count_sem));
 	up(&(sems->visitors_in_museum_sem));	
 
+	let_in(admitted);
+
 }
 
 int visitor(int n) {
 
-	visitorArrives(n);
 	tourMuseum(n);
 	visitorLeaves(n);
-	exit(0);
+	return 0;
 
 }
 
@@ -235,114 +650,1811 @@ int visitor(int n) {
 
 void tourguideArrives(int n) {
 	
+	sched_wait(ARRIVES);
 	down(&(sems->guide_count_sem));
 
 	sems->guide_count++;
-	printf("Tour guide %d arrives at time %d.\n", n, real_time()); fflush(stdout);
+	log_event(GUIDE, ARRIVES, n);
+	sched_commit(ARRIVES);
 
 	up(&(sems->guide_count_sem));
 
 }
 
-void openMuseum(int n) {
+// A guide that can't open or leave yet sleeps on its own semaphore until a turn
+// ends, then looks again. It reads guide_epoch before looking and only parks if
+// no turn has ended since, so the turn it needs can't slip in between its look
+// and its sleep. Every turn ending wakes every parked guide, most go straight
+// back to sleep, but a poll now costs one turn instead of one time slice. A
+// shared semaphore would let a guide that parks after a wakeup take the post
+// meant for one parked before it, which then sleeps through the turn. With
+// -ip the guides keep polling, a replay that diverges is only noticed by actors
+// that are still looking. Coroutine guides park on their own events (-co).
+int guide_look() {
+
+	down(&(sems->guide_wake_sem));
+	int epoch = sems->guide_epoch;
+	up(&(sems->guide_wake_sem));
+	return epoch;
 
-	bool can_open = false;
-	while (!can_open) {
+}
+
+void guide_park(int n, int epoch) {
+
+	if (sched_replay != NULL) { sched_yield(); return; }
+
+	down(&(sems->guide_wake_sem));
+	if (sems->guide_epoch != epoch) { up(&(sems->guide_wake_sem)); return; } // something happened, look again
+	sems->parked_guides[sems->guides_parked++] = n;
+	up(&(sems->guide_wake_sem));
 
-		down(&(sems->guide_count_sem));
-		down(&(sems->guides_in_museum_sem));
-		down(&(sems->spots_to_claim_sem));
-		down(&(sems->visitor_count_sem));
+	down(&(sems->guide_park_sems[n]));
 
-		can_open = (sems->visitor_count > 0) && (sems->guides_in_museum < 2);
+}
+
+void visitors_gone() {
+
+	down(&(sems->visitor_count_sem));
+	sems->visitors_coming = 0;
+	up(&(sems->visitor_count_sem));
+	guides_wake();
 
-		if (can_open) {
+}
 
-			sems->guide_count--;
+void guides_wake() {
 
-			sems->guides_in_museum++;
+	if (co_threads > 0) { return; }
 
-			sems->spots_to_claim += 10;
-			
-			printf("Tour guide %d opens the museum for tours at time %d.\n", n, real_time());
-			fflush(stdout);
+	down(&(sems->guide_wake_sem));
+	sems->guide_epoch++;
+	while (sems->guides_parked > 0) { up(&(sems->guide_park_sems[sems->parked_guides[--sems->guides_parked]])); }
+	up(&(sems->guide_wake_sem));
 
-		}		
+}
 
-		up(&(sems->guide_count_sem));
-		up(&(sems->guides_in_museum_sem));
-		up(&(sems->spots_to_claim_sem));
-		up(&(sems->visitor_count_sem));
+void openMuseum(int n) {
 
+	int admitted = 0, epoch;
+	while (true) {
+		epoch = guide_look();
+		if (try_open(n, &admitted)) { break; }
+		guide_park(n, epoch);
 	}
+	let_in(admitted);
 
 }
 
-void tourguideLeaves(int n) {
+// one pass at opening, true once the guide is in, *admitted is how many waiting visitors it took in
+bool try_open(int n, int * admitted) {
+
+	down(&(sems->guide_count_sem));
+	down(&(sems->guides_in_museum_sem));
+	down(&(sems->visitor_count_sem));
+	down(&(sems->spots_to_claim_sem));
+	down(&(sems->visitors_in_museum_sem));
 
-	bool can_leave = false;
-	int claimed_visitors = 0;
-	while (!can_leave) {
+	bool can_open = (sems->visitor_count > 0) && (sems->guides_in_museum < max_guides) && sched_allow(OPENS);
 
-		down(&(sems->claim_leaving_visitor_sem));
-		down(&(sems->guides_in_museum_sem));
-		down(&(sems->visitor_count_sem));
-		down(&(sems->visitors_in_museum_sem));
+	if (can_open) {
 
-		while (claimed_visitors < 10 && sems-> claim_leaving_visitor > 0) {
-			claimed_visitors++;
-			sems->claim_leaving_visitor--;
-		}
+		sems->guide_count--;
+
+		sems->guides_in_museum++;
+
+		sems->spots_to_claim += group_size;
 		
-		can_leave = (claimed_visitors == 10) || 
-					((sems->visitors_in_museum <= ((sems->guides_in_museum - 1) * 10)) && (sems->visitor_count == 0));
+		log_event(GUIDE, OPENS, n);
+		*admitted = admit_waiting(); // take in the whole waiting group at once
+		sched_commit(OPENS);
 
+	}		
 
-		if (can_leave) {
-			sems->guides_in_museum--;
-			printf("Tour guide %d leaves the museum at time %d.\n", n, real_time()); fflush(stdout);
-		}
+	up(&(sems->guide_count_sem));
+	up(&(sems->guides_in_museum_sem));
+	up(&(sems->spots_to_claim_sem));
+	up(&(sems->visitor_count_sem));
+	up(&(sems->visitors_in_museum_sem));
 
-		up(&(sems->claim_leaving_visitor_sem));
-		up(&(sems->guides_in_museum_sem));
-		up(&(sems->visitor_count_sem));
-		up(&(sems->visitors_in_museum_sem));
-		
+	return can_open;
+
+}
+
+void tourguideLeaves(int n) {
+
+	int claimed_visitors = 0, epoch;
+	while (true) {
+		epoch = guide_look();
+		if (try_leave(n, &claimed_visitors)) { break; }
+		guide_park(n, epoch);
+	}
+
+}
+
+// one pass at leaving, claims leaving visitors into *claimed_visitors as they show up
+bool try_leave(int n, int * claimed_visitors) {
+
+	down(&(sems->claim_leaving_visitor_sem));
+	down(&(sems->guides_in_museum_sem));
+	down(&(sems->visitor_count_sem));
+	down(&(sems->visitors_in_museum_sem));
+
+	if (*claimed_visitors < group_size && sems->claim_leaving_visitor > 0 && sched_allow(CLAIMS)) {
+		// claim as many leavers as are still owed to us in one go
+		int take = group_size - *claimed_visitors;
+		if (take > sems->claim_leaving_visitor) { take = sems->claim_leaving_visitor; }
+		*claimed_visitors += take;
+		sems->claim_leaving_visitor -= take;
+		sched_commit(CLAIMS);
+	}
+	
+	// either way the guides staying behind must be able to cover everyone still inside,
+	// with big groups and several guides claimed leavers can belong to another guide's group
+	// a guide only gives up on a short group once nobody is waiting or still on their way
+	bool can_leave = ((*claimed_visitors == group_size) || (sems->visitor_count == 0 && sems->visitors_coming == 0)) &&
+				(sems->visitors_in_museum <= ((sems->guides_in_museum - 1) * group_size)) &&
+				sched_allow(LEAVES);
+
+
+	if (can_leave) {
+		sems->guides_in_museum--;
+		log_event(GUIDE, LEAVES, n);
+		sched_commit(LEAVES);
 	}
 
+	up(&(sems->claim_leaving_visitor_sem));
+	up(&(sems->guides_in_museum_sem));
+	up(&(sems->visitor_count_sem));
+	up(&(sems->visitors_in_museum_sem));
+
+	return can_leave;
+
 }
 
 int guide(int n) {
 
-	tourguideArrives(n);
 	openMuseum(n);
 	tourguideLeaves(n);
-	exit(0);
+	return 0;
 
 }
 
-/////////////
-// UTILITY //
-/////////////
+////////////////
+// COROUTINES //
+////////////////
 
-bool next_arrives_immediatly(int prob) {
-	return ((rand() % 100) < prob);
+// With -co N there are no actor processes. Every visitor and guide is a
+// stackless coroutine, a few ints of state plus a step function that runs until
+// the actor would have to wait, records where to pick up again and returns. N
+// threads step them, each keeps the actors it makes runnable on a deque of its
+// own and steals from the others' when it runs dry. The critical sections are
+// the same functions process mode uses, only the waiting changes:
+//   - admitted visitors wait on a semaphore with a list of parked coroutines
+//     instead of admit_sem
+//   - guides that can't open or leave yet are parked until something that
+//     could let them happens, instead of polling
+//   - tours and the gaps between arrivals are timers in a heap, not sleeps
+// so a visitor that is waiting or touring costs its 12 byte coro and nothing
+// else. Schedule record/replay needs actors that block in place, so -ir/-ip
+// are not available here.
+
+struct coro {
+
+	int 		next;	// next coroutine on the wait list this one is on
+	int 		state;	// where the step function picks up
+	int 		count;	// guides: visitors claimed so far, spawners: actors arrived so far
+
+} typedef coro;
+
+// coroutines are numbered visitors first, then guides, then the two spawners
+#define CO_GUIDE(n) 	(visitors + (n))
+#define CO_SPAWNER(a) 	(visitors + guides + (a))
+
+// FIFO of coroutines linked through coro.next, -1 when empty
+struct co_list {
+
+	int 		head, tail;
+
+} typedef co_list;
+
+// counting semaphore whose waiters are parked coroutines
+struct co_sem {
+
+	pthread_mutex_t lock;
+	int 			value;
+	co_list 		waiters;
+
+} typedef co_sem;
+
+// a waiter reads gen before checking its condition and only parks if nobody
+// has signalled since, so a change made while it was checking is never lost
+struct co_event {
+
+	pthread_mutex_t lock;
+	unsigned int 	gen;
+	co_list 		waiters;
+
+} typedef co_event;
+
+struct co_timer {
+
+	long long 	wake;	// real_time() to make the coroutine runnable again
+	int 		c;
+
+} typedef co_timer;
+
+// Chase-Lev work stealing deque. The owning thread pushes and takes at the
+// bottom without locks, other threads steal from the top with one CAS. When
+// it fills up the owner swaps in an array twice the size, a thief may still
+// be reading the old one so old arrays are only freed at the end of the run.
+struct co_array {
+
+	long 				size;	// power of 2
+	struct co_array * 	older;	// the array this one replaced
+	int 				buf[];
+
+} typedef co_array;
+
+struct co_deque {
+
+	long 		top 	__attribute__((aligned(CACHE_LINE)));	// next to steal
+	long 		bottom 	__attribute__((aligned(CACHE_LINE)));	// next free slot, only the owner writes it
+	co_array * 	array;
+
+} typedef co_deque;
+
+#define CO_EMPTY 	-1
+#define CO_ABORT 	-2	// lost a race for the top, try again
+
+struct co_scheduler {
+
+	pthread_mutex_t lock;		// guards the timers and the idle bookkeeping below
+	pthread_cond_t 	work;		// idle threads wait here for work or the next timer
+	co_timer * 		timers;		// min-heap on wake
+	int 			ntimers, cap;
+	long long 		next_wake;	// wake of the earliest timer, read without the lock
+	int 			sleepers;	// threads waiting on work, read without the lock
+	int 			awake;		// threads not waiting on work
+	int 			stuck;		// nothing left that could wake the parked coroutines
+	int 			live;		// coroutines that haven't finished
+
+	co_deque * 		deques;		// one per thread
+	co_sem 			admit;		// visitors admitted but not yet let in
+	co_event 		can_open;	// guides waiting for a visitor or a free slot
+	co_event 		claims;		// guides inside waiting for more of their group to leave
+	co_event 		capacity;	// guides whose group has left, waiting for the others to cover everyone inside
+	arrivals * 		arrivals[2];
+
+} typedef co_scheduler;
+
+co_scheduler co;
+coro * coros;
+__thread co_deque * my_deque; // deque of the thread running this step
+
+void co_push(co_list * l, int c) {
+
+	coros[c].next = -1;
+	if (l->tail < 0) { l->head = c; } 
+	else 			 { coros[l->tail].next = c; }
+	l->tail = c;
 
 }
 
-int real_time() {
-	
-	struct timeval * now = malloc(sizeof(struct timeval));
-	gettimeofday(now, NULL);
-	// struct timeval * rel = malloc(sizeof(struct timeval));
+int co_pop(co_list * l) {
+
+	int c = l->head;
+	if (c >= 0) {
+		l->head = coros[c].next;
+		if (l->head < 0) { l->tail = -1; }
+	}
+	return c;
+
+}
+
+co_array * co_array_new(long size, co_array * older) {
+
+	co_array * a = malloc(sizeof(co_array) + size * sizeof(int));
+	a->size  = size;
+	a->older = older;
+	return a;
+
+}
+
+// owner only
+void co_deque_push(co_deque * d, int c) {
+
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	co_array * a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+
+	if (b - t > a->size - 1) {
+		co_array * bigger = co_array_new(a->size * 2, a);
+		long i;
+		for (i = t; i < b; i++) { bigger->buf[i & (bigger->size - 1)] = a->buf[i & (a->size - 1)]; }
+		__atomic_store_n(&d->array, bigger, __ATOMIC_RELEASE);
+		a = bigger;
+	}
+
+	__atomic_store_n(&a->buf[b & (a->size - 1)], c, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+
+}
+
+// owner only, newest first
+int co_deque_take(co_deque * d) {
+
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	co_array * a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+	int c = CO_EMPTY;
+	if (t <= b) {
+		c = __atomic_load_n(&a->buf[b & (a->size - 1)], __ATOMIC_RELAXED);
+		if (t == b) {
+			// last one, race the thieves for it
+			if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) { c = CO_EMPTY; }
+			__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+		}
+	} else {
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return c;
+
+}
+
+// any thread, oldest first
+int co_deque_steal(co_deque * d) {
+
+	long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+
+	if (t >= b) { return CO_EMPTY; }
+
+	co_array * a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+	int c = __atomic_load_n(&a->buf[t & (a->size - 1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) { return CO_ABORT; }
+	return c;
+
+}
+
+bool co_deque_empty(co_deque * d) {
+	return __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) >= __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+}
+
+// one sweep over the other threads' deques starting at a different victim each time
+int co_steal_any(int self, unsigned int * rr) {
+
+	int i, c, lost;
+	do {
+		lost = 0;
+		unsigned int first = (*rr)++;
+		for (i = 0; i < co_threads - 1; i++) {
+			co_deque * victim = &co.deques[(self + 1 + (first + i) % (co_threads - 1)) % co_threads];
+			while ((c = co_deque_steal(victim)) == CO_ABORT) { lost = 1; }
+			if (c >= 0) { return c; }
+		}
+	} while (lost);
+	return CO_EMPTY;
 
-	int tv_sec  = (int) now->tv_sec  - start_time->tv_sec;
-	int tv_usec = (int) now->tv_usec - start_time->tv_usec;
+}
+
+// wakes an idle thread if there is one, after work was made available
+void co_wake_idle() {
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); // pairs with the fence in co_thread before it rechecks the deques
+	if (__atomic_load_n(&co.sleepers, __ATOMIC_RELAXED) > 0) {
+		pthread_mutex_lock(&co.lock);
+		pthread_cond_signal(&co.work);
+		pthread_mutex_unlock(&co.lock);
+	}
+
+}
+
+// c is runnable again, the thread that woke it runs it unless someone steals it first
+void co_ready(int c) {
+
+	co_deque_push(my_deque, c);
+	co_wake_idle();
 
-	if (tv_usec < 0) { tv_sec--; }
+}
+
+void co_sleep_until(int c, long long wake) {
+
+	pthread_mutex_lock(&co.lock);
+
+	if (co.ntimers == co.cap) {
+		co.cap = co.cap ? co.cap * 2 : 1024;
+		co.timers = realloc(co.timers, co.cap * sizeof(co_timer));
+	}
+
+	int i = co.ntimers++;
+	while (i > 0 && co.timers[(i - 1) / 2].wake > wake) {
+		co.timers[i] = co.timers[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	co.timers[i].wake = wake;
+	co.timers[i].c 	  = c;
 
-	free(now);
+	// a new earliest timer changes how long idle threads should wait
+	if (i == 0) {
+		__atomic_store_n(&co.next_wake, wake, __ATOMIC_RELAXED);
+		pthread_cond_broadcast(&co.work);
+	}
 
-	return tv_sec;
+	pthread_mutex_unlock(&co.lock);
 
-}
\ No newline at end of file
+}
+
+// moves every timer that is due onto this thread's deque
+void co_timers_due() {
+
+	long long now = real_time();
+	if (__atomic_load_n(&co.next_wake, __ATOMIC_RELAXED) > now) { return; }
+
+	int moved = 0;
+	pthread_mutex_lock(&co.lock);
+	while (co.ntimers > 0 && co.timers[0].wake <= now) {
+
+		co_deque_push(my_deque, co.timers[0].c);
+		moved++;
+
+		co_timer last = co.timers[--co.ntimers];
+		int i = 0, k;
+		while ((k = 2 * i + 1) < co.ntimers) {
+			if (k + 1 < co.ntimers && co.timers[k + 1].wake < co.timers[k].wake) { k++; }
+			if (last.wake <= co.timers[k].wake) { break; }
+			co.timers[i] = co.timers[k];
+			i = k;
+		}
+		co.timers[i] = last;
+
+	}
+	__atomic_store_n(&co.next_wake, co.ntimers > 0 ? co.timers[0].wake : LLONG_MAX, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&co.lock);
+
+	if (moved > 1) { co_wake_idle(); } // share the rest
+
+}
+
+// true if c got the semaphore, otherwise c is parked and an up() makes it runnable again
+bool co_down(co_sem * sem, int c) {
+
+	pthread_mutex_lock(&sem->lock);
+	bool got = sem->value > 0;
+	if (got) { sem->value--; } 
+	else 	 { co_push(&sem->waiters, c); }
+	pthread_mutex_unlock(&sem->lock);
+	return got;
+
+}
+
+void co_up(co_sem * sem, int n) {
+
+	pthread_mutex_lock(&sem->lock);
+	while (n-- > 0) {
+		int c = co_pop(&sem->waiters);
+		if (c >= 0) { co_ready(c); } 
+		else 		{ sem->value++; }
+	}
+	pthread_mutex_unlock(&sem->lock);
+
+}
+
+void co_let_in(int admitted) { if (admitted > 0) { co_up(&co.admit, admitted); } }
+
+unsigned int co_gen(co_event * ev) { return __atomic_load_n(&ev->gen, __ATOMIC_ACQUIRE); }
+
+// parks c on ev unless ev was signalled after gen was read, then c just runs again
+void co_park(co_event * ev, unsigned int gen, int c) {
+
+	pthread_mutex_lock(&ev->lock);
+	if (ev->gen != gen) { co_ready(c); } 
+	else 				{ co_push(&ev->waiters, c); }
+	pthread_mutex_unlock(&ev->lock);
+
+}
+
+// Wakes one waiter. Every guide parked on an event waits on the same shared
+// condition, so if the one woken can't go ahead none of them could. One that
+// does go ahead signals again, so a change that lets several through reaches
+// them one after another instead of waking every guide inside on every
+// departure.
+void co_signal(co_event * ev) {
+
+	pthread_mutex_lock(&ev->lock);
+	__atomic_store_n(&ev->gen, ev->gen + 1, __ATOMIC_RELEASE);
+	int c = co_pop(&ev->waiters);
+	if (c >= 0) { co_ready(c); }
+	pthread_mutex_unlock(&ev->lock);
+
+}
+
+void co_exit(int n) {
+
+	if (__atomic_sub_fetch(&co.live, n, __ATOMIC_ACQ_REL) == 0) {
+		pthread_mutex_lock(&co.lock);
+		pthread_cond_broadcast(&co.work);
+		pthread_mutex_unlock(&co.lock);
+	}
+
+}
+
+void visitor_step(int n, coro * me) {
+
+	switch (me->state) {
+
+		case 0: // arrived, wait to be let in
+			me->state = 1;
+			if (!co_down(&co.admit, n)) { return; }
+			// fall through
+
+		case 1:
+			visitorTours(n);
+			me->state = 2;
+			if (tour_time > 0) { co_sleep_until(n, real_time() + (long long)(tour_time * 1e9)); return; }
+			// fall through
+
+		case 2:
+			visitorLeaves(n);
+			co_signal(&co.claims);		// a leaver to claim
+			co_signal(&co.capacity);	// one less visitor inside
+			co_exit(1);
+
+	}
+
+}
+
+void guide_step(int n, coro * me) {
+
+	int admitted = 0, claimed = me->count;
+	unsigned int gen, gen_capacity;
+
+	switch (me->state) {
+
+		case 0: // arrived, open once there is a visitor waiting and a free slot
+			gen = co_gen(&co.can_open);
+			if (!try_open(n, &admitted)) { co_park(&co.can_open, gen, CO_GUIDE(n)); return; }
+			let_in(admitted);
+			co_signal(&co.can_open);	// there may be a slot for one more guide
+			co_signal(&co.claims);		// fewer visitors waiting
+			co_signal(&co.capacity);	// one more guide inside covers more visitors
+			me->state = 1;
+			// fall through
+
+		case 1: // inside, leave once the group has left
+			gen 		 = co_gen(&co.claims);
+			gen_capacity = co_gen(&co.capacity);
+			if (!try_leave(n, &me->count)) {
+				if (me->count > claimed) { co_signal(&co.claims); } // there may be leavers left for another guide
+				if (me->count == group_size) { co_park(&co.capacity, gen_capacity, CO_GUIDE(n)); } 
+				else 						 { co_park(&co.claims, gen, CO_GUIDE(n)); }
+				return;
+			}
+			co_signal(&co.can_open);	// our slot is free
+			co_signal(&co.claims);		// pass it on, others may be able to leave too
+			co_signal(&co.capacity);
+			co_exit(1);
+
+	}
+
+}
+
+// the same arrival models as spawner(), but waiting on timers, one spawner
+// coroutine for the visitors and one for the guides
+void arrivals_step(int actor, coro * me) {
+
+	arrivals * a = co.arrivals[actor];
+	int n = (actor == VISITOR) ? visitors : guides;
+
+	while (me->count < n) {
+
+		if (me->state == 0) {
+
+			me->state = 1;
+			long long wake = -1;
+			if (a->model == BURST) {
+				// both spawners share this process, so each draws from its own generator instead of rand()
+				if (me->count != 0 && (int)(nrand48(a->xsubi) % 100) >= a->prob) {
+					wake = real_time() + a->delay * 1000000000LL;
+				}
+			} else {
+				double t = next_arrival(a);
+				if (t < 0) { break; } // trace ran out
+				wake = (long long)(t * 1e9);
+			}
+			if (wake > real_time()) { co_sleep_until(CO_SPAWNER(actor), wake); return; }
+
+		}
+
+		me->state = 0;
+		int i = me->count++;
+
+		if (actor == VISITOR) {
+			visitorArrives(i);
+			co_signal(&co.can_open);	// someone to open for
+			co_signal(&co.claims);		// or admitted straight away, leaving fewer waiting
+			visitor_step(i, &coros[i]);
+		} else {
+			tourguideArrives(i);
+			guide_step(i, &coros[CO_GUIDE(i)]);
+		}
+
+	}
+
+	// a trace that ran out early takes the actors it never produced with it
+	if (actor == VISITOR && me->count < n) {
+		visitors_gone();
+		co_signal(&co.claims);	// a guide short of a full group can leave now
+	}
+	co_exit(1 + n - me->count);
+
+}
+
+void co_step(int c) {
+
+	if (c < visitors) 				{ visitor_step(c, &coros[c]); } 
+	else if (c < visitors + guides) { guide_step(c - visitors, &coros[c]); } 
+	else 							{ arrivals_step(c - visitors - guides, &coros[c]); }
+
+}
+
+// -cp 1 pins thread t to the t-th CPU this process may run on, wrapping around
+void co_pin(int t) {
+
+	cpu_set_t allowed, one;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) { return; }
+
+	int want = t % CPU_COUNT(&allowed), cpu;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed) && want-- == 0) { break; }
+	}
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+
+}
+
+bool co_any_work() {
+
+	int i;
+	for (i = 0; i < co_threads; i++) { if (!co_deque_empty(&co.deques[i])) { return true; } }
+	return __atomic_load_n(&co.next_wake, __ATOMIC_RELAXED) <= real_time();
+
+}
+
+void * co_thread(void * arg) {
+
+	int self = (int)(long)arg;
+	unsigned int rr = self;
+	my_deque = &co.deques[self];
+	log_ring_index = self % LOG_RINGS;
+	if (co_pin_threads) { co_pin(self); }
+
+	while (__atomic_load_n(&co.live, __ATOMIC_ACQUIRE) > 0) {
+
+		co_timers_due();
+
+		int c = co_deque_take(my_deque);
+		if (c < 0) { c = co_steal_any(self, &rr); }
+		if (c >= 0) { co_step(c); continue; }
+
+		// nothing anywhere, sleep until someone makes work or the next timer is due
+		pthread_mutex_lock(&co.lock);
+		co.awake--;
+		__atomic_store_n(&co.sleepers, co.sleepers + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST); // pairs with co_wake_idle(), either we see the push or it sees us
+		while (!co.stuck && __atomic_load_n(&co.live, __ATOMIC_ACQUIRE) > 0 && !co_any_work()) {
+
+			// nothing runnable, nothing pending and every thread here: nobody is left who
+			// could wake whoever is still parked, they wait for a guide that is never coming
+			if (co.awake == 0 && co.ntimers == 0) { co.stuck = 1; pthread_cond_broadcast(&co.work); break; }
+
+			if (co.ntimers > 0) {
+				struct timespec when;
+				long long ns = start_time.tv_nsec + co.timers[0].wake;
+				when.tv_sec  = start_time.tv_sec + ns / 1000000000;
+				when.tv_nsec = ns % 1000000000;
+				pthread_cond_timedwait(&co.work, &co.lock, &when);
+			} else {
+				pthread_cond_wait(&co.work, &co.lock);
+			}
+
+		}
+		__atomic_store_n(&co.sleepers, co.sleepers - 1, __ATOMIC_RELAXED);
+		co.awake++;
+		bool stuck = co.stuck;
+		pthread_mutex_unlock(&co.lock);
+		if (stuck) { break; }
+
+	}
+
+	__atomic_fetch_add(&(elog->sem_calls), sem_calls, __ATOMIC_RELAXED);
+	return NULL;
+
+}
+
+void run_coroutines(arrivals * va, arrivals * ga) {
+
+	int n = visitors + guides + 2, i;
+	coros = malloc(n * sizeof(coro));
+	for (i = 0; i < n; i++) { coros[i].next = -1; coros[i].state = 0; coros[i].count = 0; }
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // timers are in real_time()
+	pthread_cond_init(&co.work, &attr);
+	pthread_mutex_init(&co.lock, NULL);
+	pthread_mutex_init(&co.admit.lock, NULL);
+	pthread_mutex_init(&co.can_open.lock, NULL);
+	pthread_mutex_init(&co.claims.lock, NULL);
+	pthread_mutex_init(&co.capacity.lock, NULL);
+
+	co_list empty = { -1, -1 };
+	co.admit.waiters = co.can_open.waiters = co.claims.waiters = co.capacity.waiters = empty;
+	co.next_wake = LLONG_MAX;
+	co.awake = co_threads;
+	co.live = n;
+	co.arrivals[VISITOR] = va;
+	co.arrivals[GUIDE] 	 = ga;
+	start_arrivals(va);
+	start_arrivals(ga);
+
+	if (posix_memalign((void **)&co.deques, CACHE_LINE, co_threads * sizeof(co_deque)) != 0) { perror("co"); exit(1); }
+	memset(co.deques, 0, co_threads * sizeof(co_deque));
+	for (i = 0; i < co_threads; i++) { co.deques[i].array = co_array_new(1024, NULL); }
+
+	// the threads haven't started, so thread 0's deque can be filled from here
+	my_deque = &co.deques[0];
+	co_deque_push(my_deque, CO_SPAWNER(VISITOR));
+	co_deque_push(my_deque, CO_SPAWNER(GUIDE));
+
+	pthread_t * threads = malloc(co_threads * sizeof(pthread_t));
+	for (i = 0; i < co_threads; i++) { pthread_create(&threads[i], NULL, co_thread, (void *)(long)i); }
+	for (i = 0; i < co_threads; i++) { pthread_join(threads[i], NULL); }
+
+	if (co.live > 0) { fprintf(stderr, "museumsim: %d actors were left waiting with nobody to let them in\n", co.live); }
+
+	for (i = 0; i < co_threads; i++) {
+		co_array * a = co.deques[i].array, * older;
+		for (; a != NULL; a = older) { older = a->older; free(a); }
+	}
+	free(co.deques);
+	free(threads);
+	free(co.timers);
+	free(coros);
+
+}
+
+//////////////
+// BACKENDS //
+//////////////
+
+// -b picks how down()/up() are implemented, so the same simulation can run on
+// the cs1550 kernel or on a stock one and the implementations can be compared.
+// Every semaphore lives in MAP_SHARED memory and is used by several processes.
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __sync_synchronize()
+#endif
+
+// only when built against the cs1550 kernel headers, elsewhere the syscall numbers belong to something else
+#ifdef __NR_cs1550_down
+void cs1550_init(msem * sem, int value) {
+	sem->cs.value = value;
+	sem->cs.head  = NULL;
+	sem->cs.tail  = NULL;
+}
+void cs1550_down(msem * sem) { syscall(__NR_cs1550_down, &(sem->cs)); }
+void cs1550_up  (msem * sem) { syscall(__NR_cs1550_up,   &(sem->cs)); }
+#endif
+
+// value never goes below 0, a sleeper re-checks it after every wakeup.
+// waiters lets up() skip the wake syscall when nobody is asleep.
+void futex_init(msem * sem, int value) {
+	sem->futex.value   = value;
+	sem->futex.waiters = 0;
+}
+
+void futex_down(msem * sem) {
+
+	while (true) {
+
+		int v = __atomic_load_n(&(sem->futex.value), __ATOMIC_RELAXED);
+		while (v > 0) {
+			if (__atomic_compare_exchange_n(&(sem->futex.value), &v, v - 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) { return; }
+		}
+
+		// not shared-private, the semaphore is used across processes.
+		// returns at once if an up() slipped in and value is no longer 0
+		__atomic_fetch_add(&(sem->futex.waiters), 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &(sem->futex.value), FUTEX_WAIT, 0, NULL, NULL, 0);
+		__atomic_fetch_sub(&(sem->futex.waiters), 1, __ATOMIC_RELAXED);
+
+	}
+
+}
+
+void futex_up(msem * sem) {
+
+	__atomic_fetch_add(&(sem->futex.value), 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&(sem->futex.waiters), __ATOMIC_SEQ_CST) > 0) {
+		syscall(SYS_futex, &(sem->futex.value), FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+
+}
+
+void posix_init(msem * sem, int value) { sem_init(&(sem->posix), 1, value); }
+void posix_down(msem * sem) { while (sem_wait(&(sem->posix)) != 0); }
+void posix_up  (msem * sem) { sem_post(&(sem->posix)); }
+
+void spin_init(msem * sem, int value) { sem->spin = value; }
+
+void spin_down(msem * sem) {
+
+	int spins = 0;
+	while (true) {
+
+		int v = __atomic_load_n(&(sem->spin), __ATOMIC_RELAXED);
+		if (v > 0 && __atomic_compare_exchange_n(&(sem->spin), &v, v - 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) { return; }
+
+		// the holder may be descheduled, give up the cpu now and then instead of burning the whole slice
+		if (++spins < 1000) { cpu_relax(); }
+		else 				{ spins = 0; sched_yield(); }
+
+	}
+
+}
+
+void spin_up(msem * sem) { __atomic_fetch_add(&(sem->spin), 1, __ATOMIC_RELEASE); }
+
+sem_backend backends[] = {
+#ifdef __NR_cs1550_down
+	{ "cs1550", cs1550_init, cs1550_down, cs1550_up },
+#endif
+	{ "futex",  futex_init,  futex_down,  futex_up  },
+	{ "posix",  posix_init,  posix_down,  posix_up  },
+	{ "spin",   spin_init,   spin_down,   spin_up   },
+	{ NULL }
+};
+
+void select_backend(const char * name) {
+
+	for (backend = backends; backend->name != NULL; backend++) {
+		if (strcmp(backend->name, name) == 0) { return; }
+	}
+
+	fprintf(stderr, "unknown backend %s, pick one of:", name);
+	for (backend = backends; backend->name != NULL; backend++) { fprintf(stderr, " %s", backend->name); }
+	fprintf(stderr, "\n");
+	exit(1);
+
+}
+
+/////////////
+//   LOG   //
+/////////////
+
+void initialize_log() {
+
+	elog = (evlog*)arena_alloc(sizeof(evlog));
+	// the arena is already zeroed, so every ring starts empty
+
+}
+
+void log_event(int actor, int type, int n) {
+
+	log_ring * ring = &elog->rings[log_ring_index];
+
+	// claim a slot, if the writer has fallen a whole ring behind wait for it to catch up
+	unsigned int pos = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+	while (pos - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= RING_SLOTS) { sched_yield(); }
+
+	log_slot * slot = &ring->slots[pos & (RING_SLOTS - 1)];
+	slot->ev.time 	= real_time();
+	slot->ev.seq 	= __atomic_fetch_add(&elog->seq, 1, __ATOMIC_RELAXED);
+	slot->ev.id 	= n;
+	slot->ev.actor 	= actor;
+	slot->ev.type 	= type;
+
+	__atomic_store_n(&slot->turn, pos + 1, __ATOMIC_RELEASE); // publish
+
+}
+
+// min-heap on seq, events can leave the rings out of order so the writer holds
+// them here until every earlier sequence number has shown up
+struct log_heap {
+
+	event * ev;
+	int 	size;
+	int 	cap;
+
+} typedef log_heap;
+
+void heap_push(log_heap * h, event * e) {
+
+	if (h->size == h->cap) {
+		h->cap = h->cap ? h->cap * 2 : RING_SLOTS;
+		h->ev  = realloc(h->ev, h->cap * sizeof(event));
+	}
+
+	int i = h->size++;
+	while (i > 0 && h->ev[(i - 1) / 2].seq > e->seq) {
+		h->ev[i] = h->ev[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	h->ev[i] = *e;
+
+}
+
+void heap_pop(log_heap * h) {
+
+	event last = h->ev[--h->size];
+	int i = 0, c;
+	while ((c = 2 * i + 1) < h->size) {
+		if (c + 1 < h->size && h->ev[c + 1].seq < h->ev[c].seq) { c++; }
+		if (last.seq <= h->ev[c].seq) { break; }
+		h->ev[i] = h->ev[c];
+		i = c;
+	}
+	h->ev[i] = last;
+
+}
+
+const char * event_text[2][4] = {
+	{ "Visitor %d arrives",    "Visitor %d tours the museum", NULL,                                   "Visitor %d leaves the museum"    },
+	{ "Tour guide %d arrives", NULL,                          "Tour guide %d opens the museum for tours", "Tour guide %d leaves the museum" }
+};
+
+// prev is the time of the event written before this one, used for -ns
+int format_event(char * buf, event * e, long long prev) {
+
+	int len = sprintf(buf, event_text[e->actor][e->type], e->id);
+
+	// seconds with microsecond resolution
+	len += sprintf(buf + len, " at time %lld.%06lld", e->time / 1000000000, e->time / 1000 % 1000000);
+	if (ns_deltas) { len += sprintf(buf + len, " (%+lldns)", e->time - prev); }
+
+	len += sprintf(buf + len, ".\n");
+	return len;
+
+}
+
+void * log_writer(void * arg) {
+
+	FILE * bin = NULL;
+	if (binary_log != NULL && (bin = fopen(binary_log, "wb")) == NULL) { perror(binary_log); }
+
+	stats_init();
+	telemetry_init();
+
+	log_heap heap = { NULL, 0, 0 };
+	unsigned int next_seq = 0;
+	long long last_time = 0;
+	char * text = malloc(LOG_FLUSH + 256);
+	int text_len = 0;
+
+	while (true) {
+
+		// read done before draining so nothing published before it can be missed
+		int done = __atomic_load_n(&elog->done, __ATOMIC_ACQUIRE);
+		int drained = 0;
+
+		int r;
+		for (r = 0; r < LOG_RINGS; r++) {
+
+			log_ring * ring = &elog->rings[r];
+			unsigned int tail = ring->tail;
+			log_slot * slot = &ring->slots[tail & (RING_SLOTS - 1)];
+
+			while (__atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) == tail + 1) {
+				heap_push(&heap, &slot->ev);
+				slot = &ring->slots[++tail & (RING_SLOTS - 1)];
+				drained++;
+			}
+
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE); // hand the slots back to producers
+
+		}
+
+		// emit everything that is now in order
+		while (heap.size > 0 && heap.ev[0].seq == next_seq) {
+
+			if (text_log) { text_len += format_event(text + text_len, &heap.ev[0], last_time); }
+			last_time = heap.ev[0].time;
+			if (bin != NULL) { fwrite(&heap.ev[0], sizeof(event), 1, bin); }
+			stats_event(&heap.ev[0]);
+			telemetry_event(&heap.ev[0]);
+			if (check) { check_push(&heap.ev[0]); }
+			next_seq++;
+			heap_pop(&heap);
+
+			if (text_len >= LOG_FLUSH) { fwrite(text, 1, text_len, stdout); text_len = 0; }
+
+		}
+
+		telemetry_tick();
+
+		if (drained == 0) {
+
+			if (text_len > 0) { fwrite(text, 1, text_len, stdout); fflush(stdout); text_len = 0; }
+			if (done) { break; }
+			usleep(1000); // nothing new, back off instead of spinning
+
+		}
+
+	}
+
+	if (check) { check_close(); }
+	telemetry_finish();
+	if (bin != NULL) { fclose(bin); }
+	free(heap.ev);
+	free(text);
+	return NULL;
+
+}
+
+/////////////
+//  STATS  //
+/////////////
+
+// Everything here runs on the writer thread from the ordered event stream,
+// so collecting statistics adds nothing to the actors' critical sections.
+
+struct stats {
+
+	long long * arrive[2];	// per actor, indexed by [VISITOR/GUIDE][id], -1 until seen
+	long long * start[2];	// visitor tours / guide opens
+	long long * leave[2];
+
+	long long 	last_time;			// time of the previous event
+	int 		in_museum[2];		// visitors / guides currently inside
+	long long 	occupied_ns;		// integral of visitors inside over time
+	long long 	capacity_ns;		// integral of guides inside * group_size over time
+	long long 	open_ns;			// time with at least one guide inside
+	long long 	events;
+
+} typedef stats;
+
+stats st;
+
+void stats_init() {
+
+	int counts[2] = { visitors, guides };
+	int a;
+	for (a = VISITOR; a <= GUIDE; a++) {
+		st.arrive[a] = malloc(counts[a] * sizeof(long long));
+		st.start[a]  = malloc(counts[a] * sizeof(long long));
+		st.leave[a]  = malloc(counts[a] * sizeof(long long));
+		memset(st.arrive[a], -1, counts[a] * sizeof(long long));
+		memset(st.start[a],  -1, counts[a] * sizeof(long long));
+		memset(st.leave[a],  -1, counts[a] * sizeof(long long));
+	}
+
+}
+
+void stats_event(event * e) {
+
+	st.events++;
+
+	long long dt = e->time - st.last_time;
+	if (dt > 0) {
+		st.occupied_ns += dt * st.in_museum[VISITOR];
+		st.capacity_ns += dt * st.in_museum[GUIDE] * group_size;
+		if (st.in_museum[GUIDE] > 0) { st.open_ns += dt; }
+		st.last_time = e->time;
+	}
+
+	switch (e->type) {
+		case ARRIVES: st.arrive[e->actor][e->id] = e->time; break;
+		case TOURS:
+		case OPENS:   st.start[e->actor][e->id]  = e->time; st.in_museum[e->actor]++; break;
+		case LEAVES:  st.leave[e->actor][e->id]  = e->time; st.in_museum[e->actor]--; break;
+	}
+
+}
+
+int cmp_ll(const void * a, const void * b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+// collects to - from for every actor that reached both points and prints its distribution in ms
+void stats_line(const char * name, long long * from, long long * to, int n) {
+
+	long long * d = malloc((n > 0 ? n : 1) * sizeof(long long));
+	int c = 0, i;
+	for (i = 0; i < n; i++) {
+		if (from[i] >= 0 && to[i] >= 0) { d[c++] = to[i] - from[i]; }
+	}
+
+	qsort(d, c, sizeof(long long), cmp_ll);
+
+	if (c == 0) {
+		printf("%-16s %8d %10s %10s %10s %10s\n", name, 0, "-", "-", "-", "-");
+	} else {
+		// nearest rank percentiles
+		printf("%-16s %8d %10.3f %10.3f %10.3f %10.3f\n", name, c,
+			d[(c * 50 + 99) / 100 - 1] / 1e6, d[(c * 90 + 99) / 100 - 1] / 1e6,
+			d[(c * 99 + 99) / 100 - 1] / 1e6, d[c - 1] / 1e6);
+	}
+
+	free(d);
+
+}
+
+void stats_report() {
+
+	printf("\n%-16s %8s %10s %10s %10s %10s\n", "(ms)", "count", "p50", "p90", "p99", "max");
+	stats_line("visitor wait", st.arrive[VISITOR], st.start[VISITOR], visitors);
+	stats_line("visitor tour", st.start[VISITOR],  st.leave[VISITOR], visitors);
+	stats_line("guide idle",   st.arrive[GUIDE],   st.start[GUIDE],   guides);
+	stats_line("guide busy",   st.start[GUIDE],    st.leave[GUIDE],   guides);
+
+	int done = 0, i;
+	for (i = 0; i < visitors; i++) { if (st.leave[VISITOR][i] >= 0) { done++; } }
+	double elapsed = st.last_time / 1e9;
+
+	printf("museum open %.3f s of %.3f s, utilization %.1f%% of guided capacity\n",
+		st.open_ns / 1e9, elapsed, st.capacity_ns > 0 ? 100.0 * st.occupied_ns / st.capacity_ns : 0.0);
+	printf("throughput %.3f visitors/s (%d visitors)\n", elapsed > 0 ? done / elapsed : 0.0, done);
+
+	// cost of the whole run, every actor has been reaped by now so RUSAGE_CHILDREN covers them
+	struct rusage self, kids;
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &kids);
+	double wall = real_time() / 1e9;
+	double user = self.ru_utime.tv_sec + kids.ru_utime.tv_sec + (self.ru_utime.tv_usec + kids.ru_utime.tv_usec) / 1e6;
+	double sys  = self.ru_stime.tv_sec + kids.ru_stime.tv_sec + (self.ru_stime.tv_usec + kids.ru_stime.tv_usec) / 1e6;
+	long switches = self.ru_nvcsw + self.ru_nivcsw + kids.ru_nvcsw + kids.ru_nivcsw;
+	long long events = st.events > 0 ? st.events : 1;
+
+	printf("run events=%lld wall_s=%.6f events_per_s=%.1f user_s=%.6f sys_s=%.6f ctx_switches=%ld "
+		"ctx_switches_per_event=%.3f sem_calls_per_event=%.3f\n",
+		st.events, wall, wall > 0 ? st.events / wall : 0.0, user, sys, switches,
+		(double)switches / events, (double)elog->sem_calls / events);
+
+	if (stats_csv != NULL) {
+
+		FILE * csv = fopen(stats_csv, "w");
+		if (csv == NULL) { perror(stats_csv); return; }
+
+		// times are ns since start, -1 if the actor never got that far
+		fprintf(csv, "actor,id,arrive_ns,start_ns,leave_ns\n");
+		int a, counts[2] = { visitors, guides };
+		for (a = VISITOR; a <= GUIDE; a++) {
+			for (i = 0; i < counts[a]; i++) {
+				fprintf(csv, "%s,%d,%lld,%lld,%lld\n", a == VISITOR ? "visitor" : "guide", i,
+					st.arrive[a][i], st.start[a][i], st.leave[a][i]);
+			}
+		}
+		fclose(csv);
+
+	}
+
+}
+
+///////////////
+// TELEMETRY //
+///////////////
+
+// With -tm the writer thread mirrors the event stream into a named shared
+// memory segment (layout in telemetry.h) that museumtop maps read only, the
+// actors never touch it. The segment is unlinked when the run ends, a viewer
+// that already has it mapped keeps the final numbers.
+
+telemetry * tm = NULL;
+long long tm_window_start = 0;		// run time the current events/s window began
+long long tm_window_events = 0;		// events seen when it began
+
+void telemetry_init() {
+
+	if (telemetry_name == NULL) { return; }
+
+	int fd = shm_open(telemetry_name, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(telemetry)) < 0) { perror(telemetry_name); return; }
+	tm = (telemetry*)mmap(NULL, sizeof(telemetry), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (tm == MAP_FAILED) { perror("mmap"); tm = NULL; return; }
+
+	tm->pid 		= getpid();
+	tm->visitors 	= visitors;
+	tm->guides 		= guides;
+	tm->group_size 	= group_size;
+	tm->max_guides 	= max_guides;
+	__atomic_store_n(&tm->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE); // readers wait for this before trusting the rest
+
+}
+
+// runs after stats_event(), so st already reflects e
+void telemetry_event(event * e) {
+
+	if (tm == NULL) { return; }
+
+	int a = e->actor;
+	switch (e->type) {
+		case ARRIVES: __atomic_store_n(&tm->waiting[a], tm->waiting[a] + 1, __ATOMIC_RELAXED); break;
+		case TOURS:
+		case OPENS:   __atomic_store_n(&tm->waiting[a], tm->waiting[a] - 1, __ATOMIC_RELAXED);
+					  __atomic_store_n(&tm->inside[a],  tm->inside[a]  + 1, __ATOMIC_RELAXED); break;
+		case LEAVES:  __atomic_store_n(&tm->inside[a],  tm->inside[a]  - 1, __ATOMIC_RELAXED);
+					  __atomic_store_n(&tm->done[a],    tm->done[a]    + 1, __ATOMIC_RELAXED); break;
+	}
+
+	if (a == VISITOR && e->type == TOURS) {
+		long long us = (e->time - st.arrive[VISITOR][e->id]) / 1000;
+		int b = us > 0 ? 64 - __builtin_clzll(us) : 0;
+		if (b >= TELEMETRY_BUCKETS) { b = TELEMETRY_BUCKETS - 1; }
+		__atomic_store_n(&tm->wait_hist[b], tm->wait_hist[b] + 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&tm->events, st.events, __ATOMIC_RELAXED);
+	__atomic_store_n(&tm->updated_ns, e->time, __ATOMIC_RELAXED);
+
+}
+
+// called once per writer pass, closes the events/s window every TELEMETRY_PERIOD
+void telemetry_tick() {
+
+	if (tm == NULL) { return; }
+
+	long long now = real_time();
+	if (now - tm_window_start < TELEMETRY_PERIOD) { return; }
+
+	long long rate = (st.events - tm_window_events) * 1000000000LL / (now - tm_window_start);
+	__atomic_store_n(&tm->events_per_s, rate, __ATOMIC_RELAXED);
+	tm_window_start  = now;
+	tm_window_events = st.events;
+
+}
+
+void telemetry_finish() {
+
+	if (tm == NULL) { return; }
+
+	__atomic_store_n(&tm->finished, 1, __ATOMIC_RELAXED);
+	munmap(tm, sizeof(telemetry));
+	shm_unlink(telemetry_name);
+
+}
+
+/////////////
+// CHECKER //
+/////////////
+
+// The writer hands every ordered event to the checker thread through a
+// single producer / single consumer ring, so the rules below are validated
+// without the actors ever waiting on them:
+//   - at most max_guides guides are in the museum at once
+//   - never more than group_size visitors per guide inside, including right
+//     after a guide leaves, i.e. a guide only leaves once its group is gone
+//   - every actor arrives, enters (tours/opens) and leaves, in that order, once
+//   - nobody is left inside or waiting when the run ends
+
+#define CHECK_SLOTS 	65536	// must be a power of 2
+#define CHECK_REPORT 	10		// violations printed before going quiet
+
+struct check_ring {
+
+	unsigned int 	head __attribute__((aligned(64)));	// written by the writer thread
+	unsigned int 	tail __attribute__((aligned(64)));	// written by the checker thread
+	int 			closed;
+	event 			ev[CHECK_SLOTS];
+
+} typedef check_ring;
+
+check_ring cring;
+
+struct check_state {
+
+	unsigned char * phase[2];	// per actor: 0 not seen, then the last of ARRIVES/TOURS or OPENS/LEAVES + 1
+	int 			inside[2];
+	long long 		checked;
+	long long 		violations;
+
+} typedef check_state;
+
+check_state chk;
+
+void check_push(event * e) {
+
+	unsigned int head = cring.head;
+	while (head - __atomic_load_n(&(cring.tail), __ATOMIC_ACQUIRE) >= CHECK_SLOTS) { sched_yield(); }
+	cring.ev[head & (CHECK_SLOTS - 1)] = *e;
+	__atomic_store_n(&(cring.head), head + 1, __ATOMIC_RELEASE);
+
+}
+
+void check_close() { __atomic_store_n(&(cring.closed), 1, __ATOMIC_RELEASE); }
+
+void violation(event * e, const char * what) {
+
+	if (chk.violations++ < CHECK_REPORT) {
+		fprintf(stderr, "invariant violated at event %u (%s %d at %lld ns): %s\n", e->seq,
+			e->actor == VISITOR ? "visitor" : "guide", e->id, e->time, what);
+	}
+
+}
+
+void check_event(event * e) {
+
+	chk.checked++;
+
+	int counts[2] = { visitors, guides };
+	if (e->id < 0 || e->id >= counts[e->actor]) { violation(e, "unknown actor"); return; }
+
+	// each actor moves through ARRIVES, then TOURS/OPENS, then LEAVES
+	unsigned char * phase = &(chk.phase[e->actor][e->id]);
+	int step = (e->type == ARRIVES) ? 1 : (e->type == LEAVES) ? 3 : 2;
+	if (*phase != step - 1) { violation(e, "out of order or repeated"); }
+	*phase = step;
+
+	if (step == 2) { chk.inside[e->actor]++; }
+	if (step == 3) { chk.inside[e->actor]--; }
+
+	if (chk.inside[GUIDE] > max_guides) { violation(e, "too many guides in the museum"); }
+	if (chk.inside[VISITOR] > chk.inside[GUIDE] * group_size) { violation(e, "too many visitors per guide"); }
+
+}
+
+void * checker(void * arg) {
+
+	chk.phase[VISITOR] = calloc(visitors, 1);
+	chk.phase[GUIDE]   = calloc(guides,   1);
+
+	while (true) {
+
+		// read closed first so nothing pushed before it can be missed
+		int closed = __atomic_load_n(&(cring.closed), __ATOMIC_ACQUIRE);
+		unsigned int head = __atomic_load_n(&(cring.head), __ATOMIC_ACQUIRE);
+		unsigned int tail = cring.tail;
+
+		while (tail != head) {
+			check_event(&(cring.ev[tail & (CHECK_SLOTS - 1)]));
+			tail++;
+		}
+		__atomic_store_n(&(cring.tail), tail, __ATOMIC_RELEASE);
+
+		if (closed && tail == __atomic_load_n(&(cring.head), __ATOMIC_ACQUIRE)) { break; }
+		usleep(1000);
+
+	}
+
+	return NULL;
+
+}
+
+void check_report() {
+
+	if (!check) { return; }
+
+	// whoever arrived but never left was stranded
+	int stuck[2] = { 0, 0 }, counts[2] = { visitors, guides }, a, i;
+	for (a = VISITOR; a <= GUIDE; a++) {
+		for (i = 0; i < counts[a]; i++) {
+			if (chk.phase[a][i] == 1 || chk.phase[a][i] == 2) { stuck[a]++; }
+		}
+	}
+	if (stuck[VISITOR] + stuck[GUIDE] > 0) {
+		fprintf(stderr, "%d visitors and %d guides never left\n", stuck[VISITOR], stuck[GUIDE]);
+		chk.violations++;
+	}
+
+	printf("invariants: %lld violations in %lld events\n", chk.violations, chk.checked);
+
+}
+
+//////////////
+// SCHEDULE //
+//////////////
+
+// -ir records the order in which actors take their turns at the semlist
+// semaphores, -ip makes every actor wait for its recorded turn, so two runs
+// (e.g. with different semaphore implementations) go through the same schedule.
+// A turn is a pass through a critical section that changes the counters, polls
+// that find they can't proceed release everything untouched and aren't recorded,
+// they would otherwise flood the recording while actors wait for each other.
+// Every counter is only read under its semaphore, so with the same order of
+// turns each actor sees the same state and makes the same decisions, as long as
+// the actors are the same ones arriving the same way, so the recording keeps the
+// settings that decide that and a replay with different ones is refused.
+
+#define SCHED_MAX 		(1 << 24)	// records a recording can hold
+#define SCHED_PATIENCE 	30			// seconds without progress before a replay is declared diverged
+#define SCHED_MAGIC 	0x44484353	// "SCHD"
+
+struct sched_rec {
+
+	int 			actor;
+	int 			id;
+	int 			type;	// ARRIVES, TOURS, OPENS, LEAVES or CLAIMS
+
+} typedef sched_rec;
+
+// what a schedule only makes sense with, [0] visitors and [1] guides
+struct sched_config {
+
+	int 			visitors, guides;	// m, k
+	int 			workers;			// w, which worker takes which actor
+	int 			group_size;			// gs
+	int 			max_guides;			// gm
+	int 			model[2];			// av/ag, TRACE for tv/tg
+	int 			prob[2], delay[2], seed[2];
+	double 			rate[2], period[2];
+
+} typedef sched_config;
+
+// on-disk layout, the file is mapped shared while recording so every process appends to it directly
+struct sched_log {
+
+	unsigned int 	magic;
+	unsigned int 	count;
+	sched_config 	config;
+	sched_rec 		recs[];
+
+} typedef sched_log;
+
+struct sched_state {
+
+	unsigned int 	cursor;		// replay: next turn allowed to happen
+	int 			diverged;	// replay: gave up enforcing the order
+	long long 		moved;		// replay: real_time() the cursor last advanced
+
+} typedef sched_state;
+
+sched_log * 	sched_file;
+sched_state * 	sched;
+int 			sched_fd = -1;
+unsigned int 	sched_len; // replay: # of records in the file
+
+void print_sched_config(const char * what, sched_config * c) {
+
+	fprintf(stderr, "  %s: -m %d -k %d -w %d -gs %d -gm %d, visitors %c %d/%d/%d %g/%g, guides %c %d/%d/%d %g/%g\n",
+		what, c->visitors, c->guides, c->workers, c->group_size, c->max_guides,
+		c->model[0], c->prob[0], c->delay[0], c->seed[0], c->rate[0], c->period[0],
+		c->model[1], c->prob[1], c->delay[1], c->seed[1], c->rate[1], c->period[1]);
+
+}
+
+void initialize_sched(struct arrivals * va, struct arrivals * ga) {
+
+	if (sched_record == NULL && sched_replay == NULL) { return; }
+
+	sched = (sched_state*)arena_alloc(sizeof(sched_state));
+
+	sched_config config;
+	memset(&config, 0, sizeof(config)); // padding too, configs are compared with memcmp
+	config.visitors 	= visitors;
+	config.guides 		= guides;
+	config.workers 		= workers;
+	config.group_size 	= group_size;
+	config.max_guides 	= max_guides;
+	struct arrivals * a[2] = { va, ga };
+	int i;
+	for (i = 0; i < 2; i++) {
+		config.model[i] 	= a[i]->model;
+		config.prob[i] 		= a[i]->prob;
+		config.delay[i] 	= a[i]->delay;
+		config.seed[i] 		= a[i]->seed;
+		config.rate[i] 		= a[i]->rate;
+		config.period[i] 	= a[i]->period;
+	}
+
+	if (sched_record != NULL) {
+
+		// sparse file, only the pages actually written take up space
+		size_t size = sizeof(sched_log) + (size_t)SCHED_MAX * sizeof(sched_rec);
+		sched_fd = open(sched_record, O_RDWR|O_CREAT|O_TRUNC, 0644);
+		if (sched_fd < 0 || ftruncate(sched_fd, size) < 0) { perror(sched_record); exit(1); }
+		sched_file = (sched_log*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, sched_fd, 0);
+		if (sched_file == MAP_FAILED) { perror("mmap"); exit(1); }
+		sched_file->magic 	= SCHED_MAGIC;
+		sched_file->config 	= config;
+
+	} else {
+
+		struct stat sb;
+		sched_fd = open(sched_replay, O_RDONLY);
+		if (sched_fd < 0 || fstat(sched_fd, &sb) < 0) { perror(sched_replay); exit(1); }
+		if ((size_t)sb.st_size < sizeof(sched_log)) {
+			fprintf(stderr, "%s: not a schedule recording, too short for a header\n", sched_replay);
+			exit(1);
+		}
+		sched_file = (sched_log*)mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, sched_fd, 0);
+		if (sched_file == MAP_FAILED) { perror("mmap"); exit(1); }
+		if (sched_file->magic != SCHED_MAGIC) {
+			fprintf(stderr, "%s: not a schedule recording\n", sched_replay);
+			exit(1);
+		}
+
+		// a different cast or arrival pattern can't follow the recorded turns, it would only stall until SCHED_PATIENCE
+		if (memcmp(&(sched_file->config), &config, sizeof(config)) != 0) {
+			fprintf(stderr, "%s was recorded with different settings:\n", sched_replay);
+			print_sched_config("recorded", &(sched_file->config));
+			print_sched_config("this run", &config);
+			exit(1);
+		}
+
+		// the count comes from the file, don't let it send sched_allow() past the end of the mapping
+		sched_len = sched_file->count;
+		if (sizeof(sched_log) + (size_t)sched_len * sizeof(sched_rec) > (size_t)sb.st_size) {
+			fprintf(stderr, "%s: header says %u turns but the file only holds %zu, truncated or not a recording\n",
+				sched_replay, sched_len, ((size_t)sb.st_size - sizeof(sched_log)) / sizeof(sched_rec));
+			exit(1);
+		}
+
+	}
+
+}
+
+// true if the next recorded turn belongs to this actor (or nothing is being replayed)
+bool sched_allow(int type) {
+
+	if (sched_replay == NULL || sched->diverged) { return true; }
+
+	unsigned int c = __atomic_load_n(&(sched->cursor), __ATOMIC_ACQUIRE);
+	if (c >= sched_len) { return true; } // past the end of the recording, run freely
+
+	sched_rec * r = &(sched_file->recs[c]);
+	if (r->actor == self_actor && r->id == self_id && r->type == type) { return true; }
+
+	// nobody has taken a turn for too long, the recorded actor is never going to show up
+	long long moved = __atomic_load_n(&(sched->moved), __ATOMIC_RELAXED);
+	if (real_time() - moved > SCHED_PATIENCE * 1000000000LL &&
+		__atomic_exchange_n(&(sched->diverged), 1, __ATOMIC_RELAXED) == 0) {
+		fprintf(stderr, "replay diverged at record %u\n", c);
+	}
+
+	return false;
+
+}
+
+// for critical sections that always change state, called before taking any semaphore
+void sched_wait(int type) {
+
+	while (!sched_allow(type)) { sched_yield(); }
+
+}
+
+// called at the end of a turn while its semaphores are still held
+void sched_commit(int type) {
+
+	guides_wake(); // the turn may have changed what a parked guide is waiting for
+
+	if (sched == NULL) { return; }
+
+	if (sched_replay != NULL) {
+		__atomic_store_n(&(sched->moved), real_time(), __ATOMIC_RELAXED);
+		__atomic_fetch_add(&(sched->cursor), 1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	unsigned int i = __atomic_fetch_add(&(sched_file->count), 1, __ATOMIC_RELAXED);
+	if (i < SCHED_MAX) {
+		sched_file->recs[i].actor = self_actor;
+		sched_file->recs[i].id    = self_id;
+		sched_file->recs[i].type  = type;
+	}
+
+}
+
+void sched_finish() {
+
+	if (sched == NULL) { return; }
+
+	if (sched_record != NULL) {
+
+		if (sched_file->count > SCHED_MAX) {
+			fprintf(stderr, "schedule truncated to %d of %u turns\n", SCHED_MAX, sched_file->count);
+			sched_file->count = SCHED_MAX;
+		}
+		printf("recorded %u turns to %s\n", sched_file->count, sched_record);
+		msync(sched_file, sizeof(sched_log), MS_SYNC);
+		if (ftruncate(sched_fd, sizeof(sched_log) + (size_t)sched_file->count * sizeof(sched_rec)) < 0) { perror(sched_record); }
+
+	} else {
+
+		printf("replayed %u of %u turns from %s%s\n", sched->cursor < sched_len ? sched->cursor : sched_len,
+			sched_len, sched_replay, sched->diverged ? " (diverged)" : "");
+
+	}
+
+	close(sched_fd);
+
+}
+
+//////////////
+// ARRIVALS //
+//////////////
+
+void start_arrivals(arrivals * a) {
+
+	srand(a->seed);
+	a->xsubi[0] = 0x330e;
+	a->xsubi[1] = a->seed & 0xffff;
+	a->xsubi[2] = (a->seed >> 16) & 0xffff;
+	a->t = 0;
+	a->on = true;
+	a->switch_at = -log(1 - erand48(a->xsubi)) * a->period;
+
+	if (a->model == TRACE) {
+
+		// the trace is mapped and parsed one line at a time as arrivals are due, never loaded whole
+		int fd = open(a->trace, O_RDONLY);
+		struct stat sb;
+		if (fd < 0 || fstat(fd, &sb) < 0) { perror(a->trace); exit(1); }
+
+		a->cur = a->end = NULL;
+		if (sb.st_size > 0) {
+			a->cur = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (a->cur == MAP_FAILED) { perror(a->trace); exit(1); }
+			madvise((void *)a->cur, sb.st_size, MADV_SEQUENTIAL);
+			a->end = a->cur + sb.st_size;
+		}
+		close(fd);
+
+	}
+
+}
+
+// parses the next arrival time out of the mapped trace, one line per arrival,
+// seconds since start as a decimal, '#' starts a comment, -1 at end of file
+double next_trace_time(arrivals * a) {
+
+	while (a->cur < a->end) {
+
+		const char * p = a->cur;
+		while (p < a->end && (*p == ' ' || *p == '\t')) { p++; }
+
+		double t = 0, scale = 0;
+		bool digits = false;
+		while (p < a->end && ((*p >= '0' && *p <= '9') || (*p == '.' && scale == 0))) {
+			if (*p == '.') 		 { scale = 1; }
+			else if (scale == 0) { t = t * 10 + (*p - '0'); digits = true; }
+			else 				 { scale /= 10; t += (*p - '0') * scale; digits = true; }
+			p++;
+		}
+
+		while (p < a->end && *p != '\n') { p++; }
+		a->cur = p + 1;
+
+		if (digits) { return t; }
+
+	}
+
+	return -1;
+
+}
+
+// absolute time in seconds since start at which the next actor arrives
+double next_arrival(arrivals * a) {
+
+	if (a->model == TRACE) { return next_trace_time(a); }
+
+	if (a->model == ONOFF) {
+
+		// exponential gaps while on, if the gap runs past the end of the on period
+		// skip the following off period and draw again from the start of the next on period
+		double t = a->t - log(1 - erand48(a->xsubi)) / a->rate;
+		while (!a->on || t > a->switch_at) {
+			double from = a->switch_at;
+			a->on = !a->on;
+			a->switch_at += -log(1 - erand48(a->xsubi)) * a->period;
+			if (a->on) { t = from - log(1 - erand48(a->xsubi)) / a->rate; }
+		}
+		return a->t = t;
+
+	}
+
+	// POISSON
+	return a->t += -log(1 - erand48(a->xsubi)) / a->rate;
+
+}
+
+void sleep_until(double t) {
+
+	// absolute deadline so time spent arriving doesn't accumulate as drift, no sleep at all if behind
+	struct timespec when;
+	long long ns = start_time.tv_nsec + (long long)(t * 1e9);
+	when.tv_sec  = start_time.tv_sec + ns / 1000000000;
+	when.tv_nsec = ns % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &when, NULL) != 0);
+
+}
+
+/////////////
+// UTILITY //
+/////////////
+
+bool next_arrives_immediatly(int prob) {
+	return ((rand() % 100) < prob);
+
+}
+
+long long real_time() {
+
+	// CLOCK_MONOTONIC is served from the vDSO, so this is neither a syscall nor an allocation
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start_time.tv_sec) * 1000000000LL + (now.tv_nsec - start_time.tv_nsec);
+
+}
+
+///////////
+// ARENA //
+///////////
+
+// Everything the processes share (semlist, both task queues, the log rings and
+// the replay cursor) is carved out of one MAP_SHARED mapping made before the
+// first fork. MAP_POPULATE allocates and zeroes all of it up front in the
+// parent, so the first actors to touch a page don't pay for that. Children
+// still take a minor fault per page to map it (the kernel doesn't copy page
+// tables of shared mappings on fork), with -hp 1 that is one fault per 2 MB
+// instead of per 4 KB. -hp uses reserved hugetlb pages if there are any
+// (vm.nr_hugepages) and falls back to asking for transparent huge pages, in
+// which case the arena is prefaulted only after madvise so the advice applies.
+
+#define HUGE_PAGE (2 << 20)
+
+char * 	arena;
+size_t 	arena_size;
+size_t 	arena_used = 0;
+
+// everything is padded to a whole cache line so neighbours never share one
+size_t arena_round(size_t size) { return (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1); }
+
+// fault in the whole arena up front like MAP_POPULATE would, for mappings made without it
+void arena_prefault() {
+
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(arena, arena_size, MADV_POPULATE_WRITE) == 0) { return; }
+#endif
+	// kernels before 5.14, touch every page (the arena is still all zeroes)
+	size_t at;
+	for (at = 0; at < arena_size; at += (size_t)sysconf(_SC_PAGESIZE)) { ((volatile char *)arena)[at] = 0; }
+
+}
+
+void initialize_arena() {
+
+	arena_size = arena_round(sizeof(evlog)) + arena_round(sizeof(semlist)) + 2 * arena_round(sizeof(taskq)) +
+				 arena_round(sizeof(sched_state)) + arena_round(guides * sizeof(int)) + arena_round(guides * sizeof(msem));
+
+	int flags = MAP_SHARED|MAP_ANONYMOUS|MAP_POPULATE;
+	arena = MAP_FAILED;
+
+	if (huge_pages) {
+		arena_size = (arena_size + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+		arena = mmap(NULL, arena_size, PROT_READ|PROT_WRITE, flags|MAP_HUGETLB, -1, 0);
+	}
+
+	if (arena == MAP_FAILED && !huge_pages) {
+		arena = mmap(NULL, arena_size, PROT_READ|PROT_WRITE, flags, -1, 0);
+		if (arena == MAP_FAILED) { perror("mmap"); exit(1); }
+	}
+
+	if (arena == MAP_FAILED) {
+		// no hugetlbfs pages to be had, ask for transparent ones instead, which only takes effect if shmem
+		// THP is enabled (/sys/kernel/mm/transparent_hugepage/shmem_enabled). The advice has to come before
+		// the pages are faulted in, MAP_POPULATE would already have filled the arena with 4 KB pages
+		arena = mmap(NULL, arena_size, PROT_READ|PROT_WRITE, flags & ~MAP_POPULATE, -1, 0);
+		if (arena == MAP_FAILED) { perror("mmap"); exit(1); }
+		madvise(arena, arena_size, MADV_HUGEPAGE);
+		arena_prefault();
+	}
+
+}
+
+void * arena_alloc(size_t size) {
+
+	void * p = arena + arena_used;
+	arena_used += arena_round(size);
+	if (arena_used > arena_size) { fprintf(stderr, "museumsim: shared arena too small\n"); exit(1); }
+	return p;
+
+}
@@ -0,0 +1,92 @@
+// museumtop, live view of a museumsim run started with -tm <name>
+
+// build: gcc -o museumtop museumtop.c
+// usage: museumtop [name] [refresh seconds], defaults /museumsim and 0.5
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+enum { VISITOR, GUIDE };
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+void show(telemetry * tm, const char * name) {
+
+	printf("\033[H\033[J"); // home and clear
+	printf("museumsim %d on %s, %.3f s%s\n\n", tm->pid, name, LOAD(tm->updated_ns) / 1e9,
+		LOAD(tm->finished) ? ", finished" : "");
+
+	printf("%-10s %8s %8s %8s %8s\n", "", "waiting", "inside", "done", "total");
+	printf("%-10s %8d %8d %8d %8d\n", "visitors", LOAD(tm->waiting[VISITOR]), LOAD(tm->inside[VISITOR]),
+		LOAD(tm->done[VISITOR]), tm->visitors);
+	printf("%-10s %8d %8d %8d %8d\n\n", "guides", LOAD(tm->waiting[GUIDE]), LOAD(tm->inside[GUIDE]),
+		LOAD(tm->done[GUIDE]), tm->guides);
+
+	int guides_in = LOAD(tm->inside[GUIDE]);
+	printf("occupancy %d/%d visitors, %d/%d guides\n", LOAD(tm->inside[VISITOR]), guides_in * tm->group_size,
+		guides_in, tm->max_guides);
+	printf("events %lld, %lld/s\n\n", LOAD(tm->events), LOAD(tm->events_per_s));
+
+	// only the range of buckets that has anything in it
+	long long hist[TELEMETRY_BUCKETS], most = 0;
+	int b, lo = TELEMETRY_BUCKETS, hi = -1;
+	for (b = 0; b < TELEMETRY_BUCKETS; b++) {
+		hist[b] = LOAD(tm->wait_hist[b]);
+		if (hist[b] > 0) { if (b < lo) { lo = b; } hi = b; }
+		if (hist[b] > most) { most = hist[b]; }
+	}
+
+	printf("visitor wait\n");
+	for (b = lo; b <= hi; b++) {
+		// bucket b holds waits under 2^b us
+		long long bound = 1LL << b;
+		if (bound < 1000)         { printf("  <%6lld us ", bound); }
+		else if (bound < 1000000) { printf("  <%6lld ms ", bound / 1000); }
+		else                      { printf("  <%6lld s  ", bound / 1000000); }
+		int bar = (int)(hist[b] * 50 / most), i;
+		printf("%8lld ", hist[b]);
+		for (i = 0; i < bar; i++) { putchar('#'); }
+		putchar('\n');
+	}
+
+	fflush(stdout);
+
+}
+
+int main(int argc, char * argv[]) {
+
+	const char * name = argc > 1 ? argv[1] : "/museumsim";
+	double refresh = argc > 2 ? atof(argv[2]) : 0.5;
+	struct timespec pause = { (time_t)refresh, (long)((refresh - (time_t)refresh) * 1e9) };
+
+	// the segment only shows up once museumsim's writer thread starts, and is
+	// empty until it has been sized, touching it before then would SIGBUS
+	int fd;
+	struct stat sb;
+	while ((fd = shm_open(name, O_RDONLY, 0)) < 0) { nanosleep(&pause, NULL); }
+	while (fstat(fd, &sb) == 0 && sb.st_size < (off_t)sizeof(telemetry)) { nanosleep(&pause, NULL); }
+
+	telemetry * tm = (telemetry*)mmap(NULL, sizeof(telemetry), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (tm == MAP_FAILED) { perror("mmap"); return 1; }
+
+	while (__atomic_load_n(&tm->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC) { nanosleep(&pause, NULL); }
+
+	while (true) {
+		int finished = LOAD(tm->finished);
+		show(tm, name);
+		if (finished) { break; }
+		nanosleep(&pause, NULL);
+	}
+
+	return 0;
+
+}
@@ -0,0 +1,35 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+// Layout of the shared memory segment museumsim -tm <name> publishes and
+// museumtop reads. Only museumsim's writer thread stores into it, every field
+// is written and read with relaxed atomics, so a reader sees each counter
+// tear free but not necessarily all of them from the same instant.
+
+#define TELEMETRY_MAGIC 	0x4d555354	// "MUST", stored last once the segment is filled in
+#define TELEMETRY_BUCKETS 	32			// wait histogram, bucket b counts waits of [2^(b-1), 2^b) us, bucket 0 under 1 us
+#define TELEMETRY_PERIOD 	250000000	// ns between events/s updates
+
+struct telemetry {
+
+	unsigned int 	magic;
+	int 			pid;				// museumsim's parent process
+	int 			finished;			// 1 once every actor has left and the log is drained
+
+	int 			visitors, guides;	// configured totals (m, k)
+	int 			group_size;			// gs
+	int 			max_guides;			// gm
+
+	long long 		updated_ns;			// run time of the last event, ns since start
+	long long 		events;				// events seen so far
+	long long 		events_per_s;		// over the last TELEMETRY_PERIOD
+
+	int 			waiting[2];			// arrived but not yet in, [VISITOR/GUIDE]
+	int 			inside[2];			// touring / open
+	int 			done[2];			// left the museum
+
+	long long 		wait_hist[TELEMETRY_BUCKETS];	// visitor arrival to tour
+
+} typedef telemetry;
+
+#endif
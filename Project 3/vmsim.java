@@ -1,179 +1,640 @@
 import java.io.File;
 import java.io.FileNotFoundException;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.RandomAccessFile;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
 import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.Collections;
-import java.util.Enumeration;
-import java.util.Hashtable;
-import java.util.LinkedList;
-import java.util.Scanner;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
 
 public class vmsim {
 
 	static String alg 	= "LRU"; 	// default value in case no input args
+	static String [] ALGS = { "OPT", "LRU", "SECOND" }; // -sweep runs these, -a with a comma separated list replaces them
 	static String file 	= "swim.trace"; // default value in case no input args
-	static int mem_accs = 0, 
-			page_faults = 0, 
-			disk_writes = 0, 
-			numframes   = 0;
+	static int numframes = 0;
+	static int [] SWEEP; // -sweep, # of frames to run each algorithm with
+	static int THREADS = Runtime.getRuntime().availableProcessors(); // -t, simulations -sweep runs at once
 	static int PAGE_SIZE_BITS = 12; 	// Page size is 4KB = 2^12
-	static ArrayList<Instruction> I; 	// used to store each line of trace file as new data structure
-	static Hashtable<Long, Page> framez; // stores pages currently in RAM for all algs
-	static Hashtable<Long, Page> pagez;	 // stores all pages that are accessed
+	static long [] T; 	// trace, one entry per line: page # << 1 | 1 if it was a store
+	static int Tn = 0;	// # of entries used in T
+	static final int MAX_TRACE = Integer.MAX_VALUE - 8; // largest array the JVM will hand out
+	static PageMap pagez;	 // stores all pages in the trace, simulations keep their own
 	static long start;	// used to store start time, for testing purposes
-	static int SCAi = 0;// "clock hand" pointer, short for Second Chance Algorithm Index
+	static boolean bench = false; // -bench, only time parsing the trace file
+	static boolean curve = false; // -curve, LRU faults and writes for every # of frames at once
+	static double SAMPLE = 1;	  // -sample, fraction of pages -curve tracks, picked by hash of the page #
 	
-	static Page [] SRAM; // data structure used to keep track of RAM in Second Chance
-	static LinkedList<Long> LRAM; // data structure used to keep track of RAM in LRU
+	static Page [] CAT;	// CAT[t] = page whose last access was at time slot t, null once it has been accessed again
+	static int [] CFEN;	// fenwick tree over CAT, 1 for each slot holding a page's last access
+	static int CT = 0;	// next time slot
+	
+	static int [] next_use; // next_use[x] = index of the next instruction after x touching the same page, for OPT
 	
 	public static void main(String args[]) {
 		
 //		start = System.nanoTime(); 	// for testing
+		if (args.length == 3 && args[0].equals("convert")) { convert(args[1], args[2]); return; } // vmsim convert <text trace> <binary trace>
 		get_cli_args(args);			// parse command line args or use default values if there are none
-		get_trace_data(); 			// get trace data from file and load into I and pagez
-		go();						// run test with given alg/tracefile/frames
-		show_results();				// print stats of test
+		if (bench) { bench_parse(); return; }
+		if (curve) { lru_curve(); return; }
+		if (SWEEP != null) { sweep(); return; }
+		
+		Simulation sim;
+		if (alg.equals("OPT")) {	// OPT needs to see the future, so only it loads the whole trace
+			get_trace_data(); 		// get trace data from file and load into T and pagez
+			sim = new Simulation(alg, numframes, next_use);
+			sim.go(T, Tn);			// run test with given alg/tracefile/frames
+		} else {
+			sim = new Simulation(alg, numframes, null);
+			stream_trace(sim);		// run test one access at a time as the trace is read, memory doesn't grow with the trace
+		}
+		show_results(sim);			// print stats of test
 //		show_time_elapsed(); 		// for testing
 		
 	}
 
-	private static void go() {
+	private static void stream_trace(Simulation sim) {
+		
+		TraceReader r = open_trace();
+		if (r.pages > 0) { sim.pagez = new PageMap((int)r.pages); } // binary traces know how many pages there are
+		
+		try {
+			while (r.next()) {
+				sim.access(r.page, r.store, -1); // only OPT looks at the instruction index
+			}
+			r.close();
+		} catch (IOException e) { System.out.println("Error reading trace file, exiting."); System.exit(0); }
+		
+		System.out.println(sim.pagez.size());
+		
+	}
+	
+	private static void sweep() { // every algorithm in ALGS with every # of frames in SWEEP, THREADS at a time over one loaded trace
+		
+		get_trace_data(); // next_use is only built if ALGS has OPT
+		
+		ExecutorService pool = Executors.newFixedThreadPool(THREADS);
+		ArrayList<Future<Simulation>> runs = new ArrayList<Future<Simulation>>();
+		
+		for (String a : ALGS) {
+			for (int n : SWEEP) {
+				final Simulation sim = new Simulation(a, n, next_use);
+				runs.add(pool.submit(() -> { sim.go(T, Tn); return sim; })); // T and next_use are only read
+			}
+		}
+		
+		System.out.println("algorithm,frames,accesses,faults,writes");
+		try {
+			for (Future<Simulation> f : runs) { // in the order they were submitted, not the order they finish
+				Simulation sim = f.get();
+				System.out.println(sim.alg + "," + sim.numframes + "," + sim.mem_accs + "," + sim.page_faults + "," + sim.disk_writes);
+			}
+		} catch (Exception e) { System.out.println("Simulation failed: " + e.getCause()); System.exit(0); }
+		
+		pool.shutdown();
+		
+	}
+	
+	private static void build_next_use() { // one backward pass over the trace, Page.next holds the last position seen so far
+		
+		next_use = new int[Tn]; // Page.next starts out as Integer.MAX_VALUE, never accessed again
+		
+		for (int x = Tn - 1; x >= 0; x--) {
+			Page pg = pagez.get(T[x] >>> 1);
+			next_use[x] = pg.next;
+			pg.next = x;
+		}
+		
+	}
+	
+	private static void lru_curve() { // Mattson: an LRU access hits with n frames iff its stack distance is at most n, so one pass covers every n
+		
+		TraceReader r = open_trace();
+		if (r.pages > 0) { pagez = new PageMap((int)(r.pages * SAMPLE)); } // only the sampled pages go in
+		
+		// With -sample (SHARDS) only pages whose hash falls under SAMPLE are tracked. Both histograms are kept by
+		// distance among the sampled pages, which is only scaled up by 1/SAMPLE to a real one when the rows go out.
+		long [] hist   = new long[1 << 10]; // hist[d] = # of sampled accesses at stack distance d
+		long [] writes = new long[1 << 10]; // disk writes with d frames = writes[1] + ... + writes[d]
+		long accesses = 0, sampled = 0, sq = 0; // all accesses, sampled ones, sum over sampled pages of their # of accesses squared
+		long under = (long)(SAMPLE * (1L << 24));
+		curve_init(1 << 16);
+		
+		try {
+			while (r.next()) {
+				
+				accesses++;
+				if (SAMPLE < 1 && (r.page * 0x9E3779B97F4A7C15L) >>> 40 >= under) { continue; } // not sampled
+				sampled++;
+				Page pg = pagez.get(r.page);
+				
+				if (pg == null) { // first access, a fault for every # of frames
+					pg = new Page(r.page);
+					pagez.put(r.page, pg);
+				} else {
+					int d = curve_distance(pg);
+					if (d >= hist.length) { hist = Arrays.copyOf(hist, 2 * d); writes = Arrays.copyOf(writes, 2 * d); }
+					hist[d]++;
+					// with fewer than d frames the page was evicted since its last access, and written back if it was dirty
+					if (pg.dirty_from < d) { writes[pg.dirty_from]++; writes[d]--; }
+					pg.dirty_from = Math.max(pg.dirty_from, d); // reloaded clean below d frames
+				}
+				
+				if (r.store) { pg.dirty_from = 1; }
+				sq += 2L * pg.accs++ + 1; // (a + 1)^2 - a^2
+				curve_touch(pg);
+				
+			}
+			r.close();
+		} catch (IOException e) { System.out.println("Error reading trace file, exiting."); System.exit(0); }
+		
+		int d = 0, e;
+		int pages = pagez.size(); // distinct sampled pages
+		if (pages >= writes.length) { writes = Arrays.copyOf(writes, pages + 1); }
+		for (int t = CT - 1; t >= 0; t--) { // pages pushed out of the smaller RAMs since their last access were written back too
+			Page pg = CAT[t];
+			if (pg == null) { continue; }
+			e = ++d; // stack distance it would have if accessed now
+			if (pg.dirty_from < e) { writes[pg.dirty_from]++; writes[e]--; }
+		}
+		
+		// the hash lets through more or fewer accesses than SAMPLE of them, count the difference as hits at distance 1 (SHARDS-adj)
+		double adj = accesses * SAMPLE - sampled;
+		if (SAMPLE < 1) { // sampling pages independently, the fault count at any # of frames is off by at most this much 95% of the time
+			double bound = 2 * Math.sqrt((1 - SAMPLE) * sq) / SAMPLE;
+			System.err.printf("sampled %d of %d accesses, %d pages, faults within +-%.0f (%.4f of accesses)%n", 
+					sampled, accesses, pagez.size(), bound, bound / accesses);
+		}
+		
+		int max = numframes > 0 ? numframes : curve_scale(pages); // past the # of pages frames nothing ever gets evicted
+		long hits = 0, w = 0;
+		StringBuilder out = new StringBuilder("frames,faults,writes\n");
+		
+		for (int n = 1, s = 1; n <= max; n++) {
+			for (; s <= pages && curve_scale(s) <= n; s++) { // every sampled distance whose real estimate fits in n frames
+				if (s < hist.length) { hits += hist[s]; }
+				w += writes[s];
+			}
+			out.append(n).append(',').append(Math.max(0, accesses - Math.round((hits + adj) / SAMPLE)))
+			   .append(',').append(Math.round(w / SAMPLE)).append('\n');
+			if (out.length() > 1 << 16) { System.out.print(out); out.setLength(0); }
+		}
+		System.out.print(out);
+		
+	}
+	
+	private static int curve_scale(int d) { // stack distance among sampled pages -> estimated real one
+		return SAMPLE == 1 ? d : (int)Math.min(Integer.MAX_VALUE - 1, Math.max(1, Math.round(d / SAMPLE)));
+	}
+	
+	private static void curve_init(int cap) {
+		CAT  = new Page[cap];
+		CFEN = new int[cap + 1];
+		CT 	 = 0;
+	}
+	
+	private static int curve_distance(Page pg) { // # of distinct pages accessed since pg was, counting pg, then forgets pg's last access
+		
+		int d = pagez.size(), i;
+		for (i = pg.slot + 1; i > 0; i -= i & -i) { d -= CFEN[i]; } // minus the last accesses at or before pg's
+		
+		for (i = pg.slot + 1; i <= CAT.length; i += i & -i) { CFEN[i]--; }
+		CAT[pg.slot] = null;
+		return d + 1;
+		
+	}
+	
+	private static void curve_touch(Page pg) { // record an access to pg at the next time slot
+		
+		if (CT == CAT.length) { curve_compact(); }
+		CAT[CT] = pg;
+		pg.slot = CT;
+		for (int i = CT + 1; i <= CAT.length; i += i & -i) { CFEN[i]++; }
+		CT++;
+		
+	}
+	
+	private static void curve_compact() { // out of time slots, renumber the live ones from 0 in the same order
+		
+		Page [] old = CAT;
+		curve_init(Math.max(old.length, 2 * pagez.size()));
+		
+		for (Page pg : old) {
+			if (pg != null) { CAT[CT] = pg; pg.slot = CT++; }
+		}
+		
+		for (int i = 1; i <= CAT.length; i++) { // build the tree in O(slots): each node passes its count up to its parent
+			if (i <= CT) { CFEN[i]++; }
+			int j = i + (i & -i);
+			if (j <= CAT.length) { CFEN[j] += CFEN[i]; }
+		}
+		
+	}
+
+	private static void show_results(Simulation sim) {
+		System.out.println("Algorithm: " 			 + sim.alg.toUpperCase());
+		System.out.println("Number of frames: " 	 + sim.numframes);
+		System.out.println("Total memory accesses: " + sim.mem_accs);
+		System.out.println("Total page faults: " 	 + sim.page_faults);
+		System.out.println("Total writes to disk: "  + sim.disk_writes);
+	}
+	
+	private static void show_time_elapsed() { // shows difference in time, for testing
+		System.out.println("Time: " + ((System.nanoTime() - start) / 1000000000.0)); 
+	}
+
+	private static TraceReader open_trace() {
 		
-		Instruction i;
-		mem_accs = I.size(); // trace file is just a list of all mem accs, so the size of the instruction list will be equal to # of mem accs
+		try { return new TraceReader(file, PAGE_SIZE_BITS); } 
+		catch (FileNotFoundException e) { System.out.println("Trace file not found, exiting."); System.exit(0); }
+		catch (IOException e) { System.out.println("Error reading trace file, exiting."); System.exit(0); }
+		return null;
 		
-		for (int x = 0; x < I.size(); x++) { // loop through all instructions
+	}
+	
+	private static void convert(String src, String dst) { // rewrite a text trace in TraceReader's binary format
+		
+		file = src;
+		TraceReader r = open_trace();
+		PageMap seen = new PageMap(1 << 10); // distinct pages, for the header
+		byte [] b = new byte[1 << 16];
+		int bn = 0;
+		long n = 0, prev = 0, d, v;
+		
+		try {
 			
-			i = I.get(x); // get current instruction, holds page # and either "l" or "s"
+			FileOutputStream out = new FileOutputStream(dst);
+			out.write(new byte[TraceReader.HEADER]); // filled in once the counts are known
 			
-			if (!framez.containsKey(i.page)) {
+			while (r.next()) {
+				
+				if (!seen.containsKey(r.page)) { seen.put(r.page, new Page(r.page)); }
+				
+				d = r.page - prev; // consecutive accesses tend to be to nearby pages, so deltas are small
+				v = ((d << 1) ^ (d >> 63)) << 1 | (r.store ? 1 : 0); // zigzag so small negative deltas stay small, store bit at the bottom
+				prev = r.page;
+				n++;
 				
-				page_faults++; // page not in RAM means page fault
+				if (bn > b.length - 10) { out.write(b, 0, bn); bn = 0; } // a varint is at most 10 bytes
+				while ((v & ~0x7FL) != 0) { b[bn++] = (byte)(v | 0x80); v >>>= 7; }
+				b[bn++] = (byte)v;
 				
-				if (!add_page_successful(i.page)) { // if page not able to be added because RAM is full, we need to evict
+			}
+			
+			out.write(b, 0, bn);
+			out.close();
+			r.close();
+			
+			RandomAccessFile hdr = new RandomAccessFile(dst, "rw");
+			hdr.writeInt(TraceReader.MAGIC);
+			hdr.writeInt(PAGE_SIZE_BITS);
+			hdr.writeLong(n);
+			hdr.writeLong(seen.size());
+			hdr.close();
+			
+		} catch (IOException e) { System.out.println("Error writing " + dst + ", exiting."); System.exit(0); }
+		
+		System.out.println(n + " accesses, " + seen.size() + " pages, " + new File(src).length() + " -> " + new File(dst).length() + " bytes");
+		
+	}
+	
+	private static void bench_parse() { // parse the trace a few times without simulating anything, later passes show the JIT compiled parser
+		
+		long bytes = new File(file).length();
+		
+		for (int pass = 1; pass <= 3; pass++) {
+			
+			long t = System.nanoTime(), n = 0, sum = 0;
+			TraceReader r = open_trace();
+			try {
+				while (r.next()) { n++; sum += r.page; } // sum keeps the parse from being optimized away
+				r.close();
+			} catch (IOException e) { System.out.println("Error reading trace file, exiting."); System.exit(0); }
+			
+			double secs = (System.nanoTime() - t) / 1000000000.0;
+			System.out.printf("pass %d: %d accesses, %d bytes in %.3f s, %.2f GB/s (checksum %x)%n", 
+					pass, n, bytes, secs, bytes / secs / 1e9, sum);
+			
+		}
+		
+	}
+
+	private static void get_trace_data() {
+		
+		TraceReader r = open_trace();
+		long n;
+		if (r.accesses > MAX_TRACE) { trace_too_long(); }
+		if (r.accesses > T.length)  { T = new long[(int)r.accesses]; } // binary traces know their length, no regrowing T
+		if (r.pages > 0) 		   { pagez = new PageMap((int)r.pages); }
+		
+		try {
+			while (r.next()) {
+				n = r.page;
+				if (Tn == T.length) {
+					if (Tn == MAX_TRACE) { trace_too_long(); }
+					T = Arrays.copyOf(T, (int)Math.min(2L * Tn, MAX_TRACE));
+				}
+				T[Tn++] = n << 1 | (r.store ? 1 : 0);
+				if (!pagez.containsKey(n)) { pagez.put(n, new Page(n)); } // if new page, add it to hash list
+			}
+			r.close();
+		} catch (IOException e) { System.out.println("Error reading trace file, exiting."); System.exit(0); }
+		
+		if (SWEEP == null) { System.out.println(pagez.size()); }
+		else 			   { System.err.println(pagez.size() + " pages"); } // keep -sweep's stdout a plain CSV table
+		
+		if (Arrays.asList(ALGS).contains("OPT")) { build_next_use(); }
+		
+	}
+
+	private static void trace_too_long() { // T is indexed by int, OPT's next_use too
+		System.out.println("Trace too long for OPT, it has more than " + MAX_TRACE + " accesses, exiting.");
+		System.exit(0);
+	}
+
+	private static void get_cli_args(String[] args) { // parse command line arguments 
+		
+		for (int i = 0; i < args.length; i++) {			
+
+			if (args[i].equals("-n")) {
+				
+				numframes = Integer.parseInt(args[i+1]);
+				
+			} else if (args[i].equals("-a")) {
+				
+				ALGS = args[i+1].toUpperCase().split(","); // more than one only makes sense with -sweep
+				
+				for (int a = 0; a < ALGS.length; a++) {
 					
-					Long old_page = null;
-					Long new_page = i.page;
+					if (ALGS[a].equals("SCA")) { ALGS[a] = "SECOND"; } 
 					
-					switch (alg) { // use algorithm based on input arg
+					boolean valid = ALGS[a].equals("OPT")  ||
+								    ALGS[a].equals("LRU")  ||
+								    ALGS[a].equals("SECOND");
 					
-						case "OPT":
-							old_page = OPT(i.page, x);
-							break;
-						case "LRU": 
-							old_page = LRU(i.page);
-							break;
-						case "SECOND":
-							old_page = SCA(i.page);
-							break;
-						default:
-							System.out.println("Invalid algorithm.");
-							System.exit(0);
-						
-					}
+					if (!valid) { System.exit(0); }
 					
-					replace_page(old_page, new_page); // swap evicted page for incoming page
-
-				}
-			
-			} else {
-				if (alg.equalsIgnoreCase("SECOND")) { set_ref(i.page, 1); } // in Second Chance we need to set R=1 every time page in RAM is accessed
-				if (alg.equalsIgnoreCase("LRU")) { // in LRU we need to move page to the back of the LinkedList if accessed
-					LRAM.remove(i.page);
-					LRAM.addLast(i.page);
 				}
+				
+				alg = ALGS[0];
+						
+			} else if (args[i].equals("-sweep")) {
+				
+				String [] n = args[i+1].split(",");
+				SWEEP = new int[n.length];
+				for (int k = 0; k < n.length; k++) { SWEEP[k] = Integer.parseInt(n[k]); }
+				
+			} else if (args[i].equals("-t")) {
+				
+				THREADS = Integer.parseInt(args[i+1]);
+				
+			} else if (args[i].equals("-bench")) {
+				
+				bench = true;
+				
+			} else if (args[i].equals("-curve")) {
+				
+				curve = true;
+				
+			} else if (args[i].equals("-sample")) {
+				
+				SAMPLE = Double.parseDouble(args[i+1]);
+				if (SAMPLE <= 0 || SAMPLE > 1) { System.out.println("-sample takes a fraction in (0, 1]."); System.exit(0); }
+				curve  = true; // only -curve samples
+				
 			}
 			
-			if (i.action.equalsIgnoreCase("s")) { set_dirty(i.page, 1); } // if page is altered we will need to write it back to disk when evicted
-			
 		}
 		
+		if (args.length != 0) { 
+			file = args[args.length -1]; 
+		} else {
+			if   (alg.equalsIgnoreCase("SECOND") && !file.equalsIgnoreCase("simple.trace"))  { numframes = 8; }
+			else if (alg.equalsIgnoreCase("LRU") &&  file.equalsIgnoreCase("simple2.trace")){ numframes = 3; } 
+			else 																		   { numframes = 2; }
+		}
+		
+		T 	  = new long[1 << 16];
+		pagez = new PageMap(1 << 10);
+		
+		
 	}
 
-	private static Long OPT(long p, int z) {
+}
+
+class Simulation { // one run of one algorithm with one # of frames, runs share nothing but the trace they read
+	
+	String alg;
+	int numframes;
+	long mem_accs = 0, 
+		 page_faults = 0, 
+		 disk_writes = 0;
+	PageMap framez; // stores pages currently in RAM for all algs
+	PageMap pagez;	// stores all pages this run has seen, with this run's state for them
+	int [] next_use;// shared, from vmsim.build_next_use, only for OPT
+	
+	int SCAi = 0;	// "clock hand" pointer, short for Second Chance Algorithm Index
+	long [] SPAGE;	// page in each clock slot, used to keep track of RAM in Second Chance
+	byte [] SREF; 	// R bit of each clock slot
+	Page [] OHEAP;	// max-heap of pages in RAM keyed on their next access, used by OPT
+	int OHEAPn = 0;	// # of pages in OHEAP
+	Page LHEAD, LTAIL; // least and most recently used pages in RAM, LRU keeps RAM as a list linked through the pages themselves
+	
+	Simulation(String alg, int numframes, int [] next_use) {
+		
+		this.alg 	   = alg;
+		this.numframes = numframes;
+		this.next_use  = next_use;
+		framez = new PageMap(numframes);
+		 pagez = new PageMap(1 << 10);
+		
+		if (alg.equals("SECOND")) { SPAGE = new long[numframes]; SREF = new byte[numframes]; }
+		if (alg.equals("OPT"))    { OHEAP = new Page[numframes]; }
+		
+	}
+	
+	void go(long [] T, int Tn) { // run every access of a loaded trace
+		
+		for (int x = 0; x < Tn; x++) { // loop through all instructions
+			access(T[x] >>> 1, (T[x] & 1) != 0, x);
+		}
+		
+	}
+	
+	void access(long page, boolean store, int x) { // simulate one memory access, x is its index in T
+		
+		mem_accs++; // trace file is just a list of all mem accs
 		
-		int [] index = new int[numframes];
-		int c = 0;
+		Page pg = framez.get(page);
 		
-		for (Enumeration<Long> key = framez.keys(); key.hasMoreElements();) { // loop through pages currently in RAM
+		if (pg == null) {
 			
-			index[c] = -1;
-			long k = framez.get(key.nextElement()).n; // get page address
+			page_faults++; // page not in RAM means page fault
+			if (!pagez.containsKey(page)) { pagez.put(page, new Page(page)); } // first time this run sees the page
 			
-			for (int i = z; i < I.size(); i++) { // start at current instruction and look for next time page is accessed
-				if (I.get(i).page == k) {
-					index[c] = i; 
-					break; // stop looping once we find next occurrence
+			if (!add_page_successful(page, x)) { // if page not able to be added because RAM is full, we need to evict
+				
+				long old_page = -1; // always set below, an unknown algorithm exits
+				long new_page = page;
+				
+				switch (alg) { // use algorithm based on input arg
+				
+					case "OPT":
+						old_page = OPT(page, x);
+						break;
+					case "LRU": 
+						old_page = LRU(page);
+						break;
+					case "SECOND":
+						old_page = SCA(page);
+						break;
+					default:
+						System.out.println("Invalid algorithm.");
+						System.exit(0);
+					
 				}
+				
+				replace_page(old_page, new_page); // swap evicted page for incoming page
+
 			}
-			
-			if (index[c] == -1) { return k; } // if page never accessed again, evict it
-			c++;
-			
-		}
 		
-		int max = 0;
-		for (int i = 0; i < index.length; i++) {
-			if (index[i] > max) { max = index[i]; }
-		} // max will be representative of the furthest away a current page in memory will be accessed - that will be the page we want to evict
+		} else {
+			if (alg.equalsIgnoreCase("OPT")) { opt_update(pg, next_use[x]); } // page is now next needed at its following access
+			if (alg.equalsIgnoreCase("SECOND")) { set_ref(page, 1); } // in Second Chance we need to set R=1 every time page in RAM is accessed
+			if (alg.equalsIgnoreCase("LRU")) { // in LRU we need to move page to the back of the list if accessed
+				lru_unlink(pg);
+				lru_append(pg);
+			}
+		}
 		
-		return I.get(max).page;  // return evicted page to be swapped in framez
+		if (store) { set_dirty(page, 1); } // if page is altered we will need to write it back to disk when evicted
 		
 	}
 
-	private static Long SCA(long p) {
+	private long OPT(long p, int z) {
 		
-		Long ret = null;
+		Page victim = OHEAP[0]; // root is the page in RAM accessed furthest in the future (or never again)
+		Page incoming = pagez.get(p);
+		
+		incoming.next = next_use[z];
+		opt_set(0, incoming); 	// incoming page takes the victim's place in the heap
+		victim.slot = -1;
+		opt_sift_down(0);
+		
+		return victim.n; // return evicted page to be swapped in framez
+		
+	}
+	
+	private void opt_push(Page pg, int next) {
+		pg.next = next;
+		opt_set(OHEAPn++, pg);
+		opt_sift_up(pg.slot);
+	}
+	
+	private void opt_update(Page pg, int next) {
+		pg.next = next;			// the next access only ever moves later,
+		opt_sift_up(pg.slot);	// so the page can only move towards the root
+	}
+	
+	private void opt_set(int i, Page pg) {
+		OHEAP[i] = pg;
+		pg.slot  = i;
+	}
+	
+	private void opt_sift_up(int i) {
+		
+		Page pg = OHEAP[i];
+		while (i > 0 && OHEAP[(i - 1) / 2].next < pg.next) {
+			opt_set(i, OHEAP[(i - 1) / 2]);
+			i = (i - 1) / 2;
+		}
+		opt_set(i, pg);
+		
+	}
+	
+	private void opt_sift_down(int i) {
+		
+		Page pg = OHEAP[i];
+		int c;
+		while ((c = 2 * i + 1) < OHEAPn) {
+			if (c + 1 < OHEAPn && OHEAP[c + 1].next > OHEAP[c].next) { c++; } // larger child
+			if (pg.next >= OHEAP[c].next) { break; }
+			opt_set(i, OHEAP[c]);
+			i = c;
+		}
+		opt_set(i, pg);
+		
+	}
+
+	private long SCA(long p) {
 		
 		for (int i = 0; i < numframes; i++) { // loop through pages currently in RAM
 			
-			if (SRAM[SCAi].ref == 0) { 
+			if (SREF[SCAi] == 0) { 
 				break; // page already had second chance, evict it
 			} else { 
-				set_ref(SRAM[SCAi].n, 0); 		// give page second chance
-				SCAi = (SCAi + 1) % numframes; 	// move to next spot on "clock"
+				SREF[SCAi] = 0; 					// give page second chance
+				if (++SCAi == numframes) { SCAi = 0; } 	// move to next spot on "clock"
 			}
 			
 		}
 		
-		ret = SRAM[SCAi].n; 		// return only page address, not Page object
-		SRAM[SCAi] = pagez.get(p); 	// replace evicted page with incoming page
-		set_ref(SRAM[SCAi].n, 0); 	// new page should start with R=0
-		SCAi = (SCAi+1) % numframes;// move to next spot on "clock"
+		long ret = SPAGE[SCAi]; 		// return only page address, not Page object
+		pagez.get(ret).slot = -1;
+		sca_place(pagez.get(p)); 	// replace evicted page with incoming page
 		return ret;  				// return evicted page to be swapped in framez
 		
 	}
 	
-	private static Long LRU(long page) {
+	private void sca_place(Page pg) { // put pg in the slot under the clock hand and move the hand on
 		
-		long ret = LRAM.pollFirst(); // head of linked list will be least recently accessed page
-		LRAM.addLast(page);			 // add incoming page to end of linked list, as it is the most recently used
-		return ret;					 // return evicted page to be swapped in framez
+		SPAGE[SCAi] = pg.n;
+		SREF[SCAi]  = 0; 	// new page should start with R=0
+		pg.slot 	= SCAi; // so set_ref can find it without searching the clock
+		if (++SCAi == numframes) { SCAi = 0; }
 		
 	}
 	
-	private static void set_dirty(long p, int b) {
-		 pagez.get(p).dirty = b; 
-		framez.get(p).dirty = b;
+	private long LRU(long page) {
+		
+		Page victim = LHEAD;		 // head of linked list will be least recently accessed page
+		lru_unlink(victim);
+		lru_append(pagez.get(page)); // add incoming page to end of linked list, as it is the most recently used
+		return victim.n;			 // return evicted page to be swapped in framez
+		
 	}
 	
-	private static void set_ref(long p, int b) {
+	private void lru_unlink(Page pg) {
 		
-		if (alg.equalsIgnoreCase("SECOND")) {
-			for (int i = 0; i < numframes; i++) { // find correct page in RAM to set R=b
-				if (SRAM[i].n == p) {
-					SRAM[i].ref = b;
-					break; // dont need to finish loop once we find page
-				}
-			}
-		}
+		if (pg.older != null) { pg.older.newer = pg.newer; } else { LHEAD = pg.newer; }
+		if (pg.newer != null) { pg.newer.older = pg.older; } else { LTAIL = pg.older; }
+		pg.older = pg.newer = null;
 		
-		pagez.get(p).ref  = b;
-		if (framez.get(p) != null) { framez.get(p).ref = b; }
+	}
+	
+	private void lru_append(Page pg) {
 		
+		pg.older = LTAIL;
+		if (LTAIL != null) { LTAIL.newer = pg; } else { LHEAD = pg; }
+		LTAIL = pg;
+		
+	}
+	
+	private void set_dirty(long p, int b) {
+		pagez.get(p).dirty = b; // framez holds the same Page objects
+	}
+	
+	private void set_ref(long p, int b) {
+		SREF[framez.get(p).slot] = (byte)b; // page records its clock slot while in RAM
 	}
 		
-	private static void replace_page(Long old_page, Long new_page) {
+	private void replace_page(long old_page, long new_page) {
 		
 		disk_writes += framez.get(old_page).dirty; // if page was dirty, we need to write it back to disk
 		set_dirty(old_page, 0);	// set dirty bit back to 0
@@ -182,18 +643,19 @@ public class vmsim {
 		
 	}
 
-	private static boolean add_page_successful(long p) {
+	private boolean add_page_successful(long p, int x) {
 		
 		if (framez.size() < numframes) { // if RAM isnt full, then add to RAM
 			framez.put(p, pagez.get(p));
 			
+			if (alg.equals("OPT")) { opt_push(pagez.get(p), next_use[x]); } // add to OPT heap keyed on when it is needed next
+			
 			if (alg.equals("SECOND")) { // add to Second Chance helper data structure if need be
-				SRAM[SCAi] = pagez.get(p);
-				SCAi = (SCAi + 1) % numframes;
+				sca_place(pagez.get(p));
 			}
 			
 			if (alg.equalsIgnoreCase("LRU")) { // add to LRU helper data structure if need be
-				LRAM.addLast(p);
+				lru_append(pagez.get(p));
 			}
 			
 			return true;
@@ -203,101 +665,97 @@ public class vmsim {
 	
 	}
 
-	private static void show_results() {
-		System.out.println("Algorithm: " 			 + alg.toUpperCase());
-		System.out.println("Number of frames: " 	 + numframes);
-		System.out.println("Total memory accesses: " + mem_accs);
-		System.out.println("Total page faults: " 	 + page_faults);
-		System.out.println("Total writes to disk: "  + disk_writes);
+}
+
+class PageMap { // page # -> Page, open addressing with linear probing so lookups dont box the page #
+	
+	private long [] keys;
+	private Page [] vals; // null marks an empty slot
+	private int n = 0, mask;
+	
+	PageMap(int expected) {
+		int cap = 16;
+		while (cap < 2 * expected) { cap <<= 1; } // keep at most half full
+		keys = new long[cap];
+		vals = new Page[cap];
+		mask = cap - 1;
 	}
 	
-	private static void show_time_elapsed() { // shows difference in time, for testing
-		System.out.println("Time: " + ((System.nanoTime() - start) / 1000000000.0)); 
+	private int home(long k) { // fibonacci hashing, page #s are mostly consecutive
+		return (int)((k * 0x9E3779B97F4A7C15L) >>> 32) & mask;
 	}
-
-	private static void get_trace_data() {
-		
-		Scanner fStream = null;
-		String s = null;
-		long   n = 0;
-		try { fStream = new Scanner(new File(file)); } 
-		catch (FileNotFoundException e) { System.out.println("Trace file not found, exiting."); System.exit(0); }
-		
-		while (fStream.hasNext()) {
-			s = fStream.next(); // stores either "s" or "l"
-			n = Long.parseLong(fStream.next().substring(2), 16) >> PAGE_SIZE_BITS; // dont need exact address, the page it is contained in will do
-			I.add(new Instruction(s, n));
-			if (!pagez.containsKey(n)) { pagez.put(n, new Page(n)); } // if new page, add it to hash list
+	
+	Page get(long k) {
+		for (int i = home(k); vals[i] != null; i = (i + 1) & mask) {
+			if (keys[i] == k) { return vals[i]; }
 		}
+		return null;
+	}
+	
+	boolean containsKey(long k) { return get(k) != null; }
+	
+	int size() { return n; }
+	
+	void put(long k, Page v) {
 		
-		System.out.println(pagez.size());
+		int i;
+		for (i = home(k); vals[i] != null; i = (i + 1) & mask) {
+			if (keys[i] == k) { vals[i] = v; return; }
+		}
+		keys[i] = k;
+		vals[i] = v;
+		if (2 * ++n > keys.length) { grow(); }
 		
 	}
-
-	private static void get_cli_args(String[] args) { // parse command line arguments 
-		
-		for (int i = 0; i < args.length; i++) {			
-
-			if (args[i].equals("-n")) {
-				
-				numframes = Integer.parseInt(args[i+1]);
-				
-			} else if (args[i].equals("-a")) {
-				
-				alg = args[i+1].toUpperCase();
-				if (alg.equals("SCA")) { alg = "SECOND"; } 
-				
-				boolean valid = alg.equalsIgnoreCase("OPT")  ||
-							    alg.equalsIgnoreCase("LRU")  ||
-							    alg.equalsIgnoreCase("SECOND");
-				
-				if (!valid) { System.exit(0); }
-						
+	
+	void remove(long k) {
+		
+		int i = home(k);
+		while (vals[i] != null && keys[i] != k) { i = (i + 1) & mask; }
+		if (vals[i] == null) { return; }
+		vals[i] = null;
+		n--;
+		
+		// shift back any later entry of the run that can't be found past the hole anymore
+		for (int j = (i + 1) & mask; vals[j] != null; j = (j + 1) & mask) {
+			if (((j - home(keys[j])) & mask) >= ((j - i) & mask)) {
+				keys[i] = keys[j];
+				vals[i] = vals[j];
+				vals[j] = null;
+				i = j;
 			}
-			
 		}
 		
-		if (args.length != 0) { 
-			file = args[args.length -1]; 
-		} else {
-			if   (alg.equalsIgnoreCase("SECOND") && !file.equalsIgnoreCase("simple.trace"))  { numframes = 8; }
-			else if (alg.equalsIgnoreCase("LRU") &&  file.equalsIgnoreCase("simple2.trace")){ numframes = 3; } 
-			else 																		   { numframes = 2; }
+	}
+	
+	private void grow() {
+		
+		long [] ok = keys;
+		Page [] ov = vals;
+		keys = new long[2 * ok.length];
+		vals = new Page[2 * ov.length];
+		mask = keys.length - 1;
+		n 	 = 0;
+		for (int i = 0; i < ok.length; i++) {
+			if (ov[i] != null) { put(ok[i], ov[i]); }
 		}
 		
-		I 	   = new ArrayList<Instruction>();
-		framez = new Hashtable<Long, Page>((int)(numframes));
-		 pagez = new Hashtable<Long, Page>();
-		
-		if (alg.equalsIgnoreCase("SECOND")) { SRAM = new Page[numframes]; }
-		if (alg.equalsIgnoreCase("LRU"))    { LRAM = new LinkedList<Long>(); }
-		
-		
 	}
-
-}
-
-class Instruction {
-	
-	public String   action; // "l" or "s"
-	public long 	page;	// address >> 12
 	
-	Instruction(String s, long i) {
-		this.action = s;
-		this.page	= i;
-	}
-
 }
 
 class Page {
 	
 	public long n;
-	public int 	ref   = 0;
 	public int  dirty = 0;
+	public int  next  = Integer.MAX_VALUE; 	// OPT: index of the next instruction accessing this page
+	public int  slot  = -1;					// OPT: position in OHEAP, SECOND: clock slot, -1 if not in RAM, -curve: time slot of its last access
+	public int  dirty_from = Integer.MAX_VALUE; // -curve: dirty with this many frames or more
+	public int  accs = 0;					// -curve -sample: accesses so far, for the error bound
+	public Page older, newer;				// LRU: neighbours in the recency list while in RAM
 	
 	Page(Page p) {
 		this.n 		= p.n;
-		this.ref 	= p.ref;
 		this.dirty 	= p.dirty;
 	}
 	
@@ -306,3 +764,103 @@ class Page {
 	}
 	
 }
+
+class TraceReader { // decodes "<action> 0x<address>" lines straight out of the memory mapped trace, no String or object per access
+	
+	// A binary trace (vmsim convert) is a HEADER of int MAGIC, int page bits, long accesses, long pages,
+	// then one unsigned LEB128 varint per access: zigzag(page - previous page) << 1 | 1 if it was a store.
+	
+	static final int WINDOW = 1 << 30; // bytes mapped at once, one MappedByteBuffer can't cover a trace over 2 GB
+	static final int MAX_LINE = 64;	  // longer than any record, remap before one could run off the end of the window
+	static final int MAGIC  = 0x564D5431; // "VMT1"
+	static final int HEADER = 24;
+	
+	public boolean store; 	// action was "s"
+	public long    page;	// address >> page bits
+	public long accesses = -1, pages = -1; // from a binary trace's header, -1 for a text trace
+	
+	private boolean binary;
+	private long left, prev; // binary: accesses not read yet, page of the last one
+	private FileChannel ch;
+	private MappedByteBuffer buf;
+	private long size, base; // file size, file offset of buf
+	private int pos, lim;	 // next byte to parse and end of buf
+	private int bits;
+	
+	TraceReader(String file, int page_bits) throws IOException {
+		this.ch   = new RandomAccessFile(file, "r").getChannel();
+		this.size = ch.size();
+		this.bits = page_bits;
+		map(0);
+		
+		if (lim >= HEADER && buf.getInt(0) == MAGIC) {
+			if (buf.getInt(4) != bits) { throw new IOException("trace was converted with a different page size"); }
+			binary	 = true;
+			accesses = left = buf.getLong(8);
+			pages 	 = buf.getLong(16);
+			pos 	 = HEADER;
+		}
+	}
+	
+	private void map(long at) throws IOException {
+		base = at;
+		lim  = (int)Math.min(WINDOW, size - at);
+		buf  = ch.map(FileChannel.MapMode.READ_ONLY, at, lim);
+		pos  = 0;
+	}
+	
+	boolean next() throws IOException { // false at end of trace
+		
+		if (binary) { return next_binary(); }
+		
+		while (true) { // skip to the next record, making sure all of it is mapped
+			while (pos < lim && buf.get(pos) <= ' ') { pos++; }
+			if (base + pos == size) { return false; }
+			if (lim - pos >= MAX_LINE || base + lim == size) { break; }
+			map(base + pos);
+		}
+		
+		int p = pos;
+		byte c = buf.get(p);
+		while (p < lim && buf.get(p) > ' ') { p++; }
+		store = (p - pos == 1) && (c == 's' || c == 'S');
+		
+		while (p < lim && buf.get(p) <= ' ') { p++; }
+		p += 2; // skip "0x"
+		
+		long addr = 0;
+		for (; p < lim && (c = buf.get(p)) > ' '; p++) {
+			addr = (addr << 4) | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+		}
+		page = addr >>> bits; // dont need exact address, the page it is contained in will do
+		pos  = p;
+		return true;
+		
+	}
+	
+	private boolean next_binary() throws IOException {
+		
+		if (left == 0) { return false; }
+		if (lim - pos < MAX_LINE && base + lim < size) { map(base + pos); }
+		
+		long v = 0;
+		int shift = 0;
+		byte c;
+		do {
+			c = buf.get(pos++);
+			v |= (long)(c & 0x7F) << shift;
+			shift += 7;
+		} while (c < 0); // high bit set, more bytes follow
+		
+		store = (v & 1) != 0;
+		v >>>= 1;
+		prev += (v >>> 1) ^ -(v & 1); // undo zigzag
+		page  = prev;
+		left--;
+		return true;
+		
+	}
+	
+	void close() throws IOException { ch.close(); }
+	
+}